@@ -0,0 +1,512 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <iterator>
+#include <type_traits>
+#include <utility>
+
+// Every node is aligned to a cache line which, with the default B, holds the count, the
+// leaf flag and all values, so a search reads one line of values per level, plus one
+// line of child pointers in inner nodes, instead of one line per value as in NodeAvl.
+template <typename ValueType, size_t B>
+struct alignas(64) NodeBTree {
+    static_assert(B >= 4, "B-tree node must hold at least 4 values");
+
+    int count = 0;
+    const bool is_leaf;
+    ValueType values[B];
+
+    explicit NodeBTree(bool is_leaf)
+        : is_leaf(is_leaf)
+    {
+    }
+
+    int LowerBound(const ValueType& value) const
+    {
+        return std::lower_bound(values, values + count, value) - values;
+    }
+
+    int UpperBound(const ValueType& value) const
+    {
+        return std::upper_bound(values, values + count, value) - values;
+    }
+};
+
+// Leaves hold the values and are linked in order, so iteration never climbs the tree.
+template <typename ValueType, size_t B>
+struct LeafBTree : NodeBTree<ValueType, B> {
+    LeafBTree* prev = nullptr;
+    LeafBTree* next = nullptr;
+
+    LeafBTree()
+        : NodeBTree<ValueType, B>(true)
+    {
+    }
+};
+
+// Inner nodes hold separators: values in children[i] < values[i] <= values in children[i + 1].
+template <typename ValueType, size_t B>
+struct InnerBTree : NodeBTree<ValueType, B> {
+    NodeBTree<ValueType, B>* children[B + 1];
+
+    InnerBTree()
+        : NodeBTree<ValueType, B>(false)
+    {
+    }
+};
+
+// Most values which fit in the first cache line of a node after its count and leaf flag
+template <typename ValueType>
+constexpr size_t BTreeDefaultB()
+{
+    constexpr size_t kHeader = (sizeof(int) + sizeof(bool) + alignof(ValueType) - 1) /
+                               alignof(ValueType) * alignof(ValueType);
+    return std::max<size_t>(4, (64 - std::min<size_t>(kHeader, 64)) / sizeof(ValueType));
+}
+
+// B+ tree with the same interface as Set. By default the count and values of a node
+// share one cache line.
+template <typename ValueType, size_t B = BTreeDefaultB<ValueType>()>
+class BTreeSet {
+public:
+    using key_type = ValueType;
+    using value_type = ValueType;
+    using size_type = size_t;
+    using node_type = NodeBTree<value_type, B>;
+    using leaf_type = LeafBTree<value_type, B>;
+    using inner_type = InnerBTree<value_type, B>;
+
+    class iterator {
+    private:
+        const leaf_type* leaf;
+        int index;
+        const BTreeSet<ValueType, B>* set;
+
+    public:
+        using iterator_category = std::bidirectional_iterator_tag;
+        using value_type = ValueType;
+        using reference = std::add_lvalue_reference_t<std::add_const_t<value_type>>;
+        using pointer = std::add_pointer_t<std::add_const_t<value_type>>;
+        using difference_type = int64_t;
+
+        iterator(const leaf_type* leaf, int index, const BTreeSet<ValueType, B>* set)
+            : leaf(leaf)
+            , index(index)
+            , set(set)
+        {
+        }
+        iterator()
+            : leaf(nullptr)
+            , index(0)
+            , set(nullptr)
+        {
+        }
+
+        inline iterator& operator++()
+        {
+            if (++index == leaf->count) {
+                leaf = leaf->next;
+                index = 0;
+            }
+            return *this;
+        }
+
+        inline iterator& operator--()
+        {
+            if (leaf == nullptr) {
+                leaf = set->last_leaf_;
+                index = leaf->count - 1;
+            } else if (index == 0) {
+                leaf = leaf->prev;
+                index = leaf->count - 1;
+            } else {
+                --index;
+            }
+            return *this;
+        }
+
+        iterator operator++(int)
+        {
+            iterator old = *this;
+            ++(*this);
+            return old;
+        }
+        iterator operator--(int)
+        {
+            iterator old = *this;
+            --(*this);
+            return old;
+        }
+
+        reference operator*() const { return leaf->values[index]; }
+        pointer operator->() const { return &leaf->values[index]; }
+
+        bool operator==(const iterator& other) const
+        {
+            return leaf == other.leaf && index == other.index;
+        }
+        bool operator!=(const iterator& other) const { return !(*this == other); }
+    };
+
+    BTreeSet() = default;
+
+    template <typename InputIt>
+    BTreeSet(InputIt first, InputIt last)
+    {
+        while (first != last) {
+            insert(*first++);
+        }
+    }
+
+    explicit BTreeSet(std::initializer_list<ValueType> list)
+        : BTreeSet(list.begin(), list.end())
+    {
+    }
+
+    BTreeSet(const BTreeSet<ValueType, B>& other) // O(n log n)
+        : BTreeSet(other.begin(), other.end())
+    {
+    }
+
+    ~BTreeSet()
+    {
+        Clear(root_);
+    }
+
+    BTreeSet<ValueType, B>& operator=(const BTreeSet<ValueType, B>& other) // O(n log n)
+    {
+        if (this == &other)
+            return *this;
+
+        Clear(root_);
+        root_ = nullptr;
+        first_leaf_ = last_leaf_ = nullptr;
+        size_ = 0;
+
+        for (const auto& x : other) {
+            insert(x);
+        }
+
+        return *this;
+    }
+
+    iterator begin() const { return { first_leaf_, 0, this }; }
+    iterator end() const { return { nullptr, 0, this }; }
+
+    // Splits move values, so a value of this set would change under the descent; the
+    // insert works on a copy
+    void insert(const ValueType& new_value)
+    {
+        const ValueType value = new_value;
+        if (root_ == nullptr) {
+            root_ = first_leaf_ = last_leaf_ = new leaf_type();
+        }
+        if (root_->count == static_cast<int>(B)) {
+            auto new_root = new inner_type();
+            new_root->children[0] = root_;
+            SplitChild(new_root, 0);
+            root_ = new_root;
+        }
+
+        node_type* node = root_;
+        while (!node->is_leaf) {
+            auto inner = static_cast<inner_type*>(node);
+            int index = inner->UpperBound(value);
+            if (inner->children[index]->count == static_cast<int>(B)) {
+                SplitChild(inner, index);
+                if (!(value < inner->values[index])) {
+                    ++index;
+                }
+            }
+            node = inner->children[index];
+        }
+
+        int position = node->LowerBound(value);
+        if (position < node->count && !(value < node->values[position])) {
+            return;
+        }
+        std::move_backward(node->values + position, node->values + node->count,
+                           node->values + node->count + 1);
+        node->values[position] = value;
+        ++node->count;
+        ++size_;
+    }
+
+    void erase(iterator iter)
+    {
+        if (iter == end()) {
+            return;
+        }
+        erase(*iter);
+    }
+
+    // Borrows and merges move values and free nodes, so the erase works on a copy of a
+    // value which may be in this set
+    void erase(const ValueType& old_value)
+    {
+        const ValueType value = old_value;
+        if (root_ == nullptr) {
+            return;
+        }
+
+        node_type* node = root_;
+        while (!node->is_leaf) {
+            auto inner = static_cast<inner_type*>(node);
+            int index = inner->UpperBound(value);
+            if (inner->children[index]->count <= kMinCount) {
+                index = FixChild(inner, index);
+            }
+            node = inner->children[index];
+            if (inner == root_ && inner->count == 0) {
+                root_ = node;
+                delete inner;
+            }
+        }
+
+        int position = node->LowerBound(value);
+        if (position == node->count || value < node->values[position]) {
+            return;
+        }
+        std::move(node->values + position + 1, node->values + node->count,
+                  node->values + position);
+        --node->count;
+        --size_;
+
+        if (root_->count == 0) {
+            assert(root_->is_leaf);
+            delete static_cast<leaf_type*>(root_);
+            root_ = nullptr;
+            first_leaf_ = last_leaf_ = nullptr;
+        }
+    }
+
+    iterator find(const ValueType& value) const
+    {
+        auto leaf = FindLeaf(value);
+        if (leaf == nullptr) {
+            return end();
+        }
+        int position = leaf->LowerBound(value);
+        if (position == leaf->count || value < leaf->values[position]) {
+            return end();
+        }
+        return { leaf, position, this };
+    }
+    iterator lower_bound(const ValueType& value) const
+    {
+        auto leaf = FindLeaf(value);
+        return leaf == nullptr ? end() : MakeIterator(leaf, leaf->LowerBound(value));
+    }
+    iterator upper_bound(const ValueType& value) const
+    {
+        auto leaf = FindLeaf(value);
+        return leaf == nullptr ? end() : MakeIterator(leaf, leaf->UpperBound(value));
+    }
+
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+
+private:
+    // Every node but the root keeps at least kMinCount values.
+    static constexpr int kMinCount = (B - 1) / 2;
+
+    node_type* root_ = nullptr;
+    leaf_type* first_leaf_ = nullptr;
+    leaf_type* last_leaf_ = nullptr;
+    size_t size_ = 0;
+
+    static void Clear(node_type* node)
+    {
+        if (node == nullptr) {
+            return;
+        }
+        if (node->is_leaf) {
+            delete static_cast<leaf_type*>(node);
+            return;
+        }
+        auto inner = static_cast<inner_type*>(node);
+        for (int i = 0; i <= inner->count; ++i) {
+            Clear(inner->children[i]);
+        }
+        delete inner;
+    }
+
+    const leaf_type* FindLeaf(const ValueType& value) const
+    {
+        const node_type* node = root_;
+        if (node == nullptr) {
+            return nullptr;
+        }
+        while (!node->is_leaf) {
+            auto inner = static_cast<const inner_type*>(node);
+            node = inner->children[inner->UpperBound(value)];
+        }
+        return static_cast<const leaf_type*>(node);
+    }
+
+    iterator MakeIterator(const leaf_type* leaf, int position) const
+    {
+        if (position == leaf->count) {
+            return { leaf->next, 0, this };
+        }
+        return { leaf, position, this };
+    }
+
+    // Splits the full child parent->children[index] in two halves; parent must not be full.
+    void SplitChild(inner_type* parent, int index)
+    {
+        node_type* child = parent->children[index];
+        node_type* right;
+        ValueType separator;
+        const int middle = B / 2;
+
+        if (child->is_leaf) {
+            auto left_leaf = static_cast<leaf_type*>(child);
+            auto right_leaf = new leaf_type();
+            std::move(left_leaf->values + middle, left_leaf->values + B, right_leaf->values);
+            right_leaf->count = B - middle;
+            left_leaf->count = middle;
+
+            right_leaf->prev = left_leaf;
+            right_leaf->next = left_leaf->next;
+            if (left_leaf->next != nullptr) {
+                left_leaf->next->prev = right_leaf;
+            } else {
+                last_leaf_ = right_leaf;
+            }
+            left_leaf->next = right_leaf;
+
+            separator = right_leaf->values[0];
+            right = right_leaf;
+        } else {
+            auto left_inner = static_cast<inner_type*>(child);
+            auto right_inner = new inner_type();
+            separator = std::move(left_inner->values[middle]);
+            std::move(left_inner->values + middle + 1, left_inner->values + B,
+                      right_inner->values);
+            std::copy(left_inner->children + middle + 1, left_inner->children + B + 1,
+                      right_inner->children);
+            right_inner->count = B - 1 - middle;
+            left_inner->count = middle;
+            right = right_inner;
+        }
+
+        std::move_backward(parent->values + index, parent->values + parent->count,
+                           parent->values + parent->count + 1);
+        std::copy_backward(parent->children + index + 1, parent->children + parent->count + 1,
+                           parent->children + parent->count + 2);
+        parent->values[index] = std::move(separator);
+        parent->children[index + 1] = right;
+        ++parent->count;
+    }
+
+    // Makes parent->children[index] hold more than kMinCount values by borrowing from
+    // or merging with a sibling. Returns the index of the child that now covers its range.
+    int FixChild(inner_type* parent, int index)
+    {
+        if (index > 0 && parent->children[index - 1]->count > kMinCount) {
+            BorrowFromLeft(parent, index);
+            return index;
+        }
+        if (index < parent->count && parent->children[index + 1]->count > kMinCount) {
+            BorrowFromRight(parent, index);
+            return index;
+        }
+        if (index > 0) {
+            MergeChildren(parent, index - 1);
+            return index - 1;
+        }
+        MergeChildren(parent, index);
+        return index;
+    }
+
+    void BorrowFromLeft(inner_type* parent, int index)
+    {
+        node_type* child = parent->children[index];
+        node_type* left = parent->children[index - 1];
+        std::move_backward(child->values, child->values + child->count,
+                           child->values + child->count + 1);
+
+        if (child->is_leaf) {
+            child->values[0] = std::move(left->values[left->count - 1]);
+            parent->values[index - 1] = child->values[0];
+        } else {
+            auto child_inner = static_cast<inner_type*>(child);
+            auto left_inner = static_cast<inner_type*>(left);
+            std::copy_backward(child_inner->children, child_inner->children + child->count + 1,
+                               child_inner->children + child->count + 2);
+            child_inner->values[0] = std::move(parent->values[index - 1]);
+            child_inner->children[0] = left_inner->children[left->count];
+            parent->values[index - 1] = std::move(left->values[left->count - 1]);
+        }
+
+        --left->count;
+        ++child->count;
+    }
+
+    void BorrowFromRight(inner_type* parent, int index)
+    {
+        node_type* child = parent->children[index];
+        node_type* right = parent->children[index + 1];
+
+        if (child->is_leaf) {
+            child->values[child->count] = std::move(right->values[0]);
+            std::move(right->values + 1, right->values + right->count, right->values);
+            parent->values[index] = right->values[0];
+        } else {
+            auto child_inner = static_cast<inner_type*>(child);
+            auto right_inner = static_cast<inner_type*>(right);
+            child_inner->values[child->count] = std::move(parent->values[index]);
+            child_inner->children[child->count + 1] = right_inner->children[0];
+            parent->values[index] = std::move(right->values[0]);
+            std::move(right->values + 1, right->values + right->count, right->values);
+            std::copy(right_inner->children + 1, right_inner->children + right->count + 1,
+                      right_inner->children);
+        }
+
+        --right->count;
+        ++child->count;
+    }
+
+    // Merges parent->children[index + 1] into parent->children[index].
+    void MergeChildren(inner_type* parent, int index)
+    {
+        node_type* left = parent->children[index];
+        node_type* right = parent->children[index + 1];
+
+        if (left->is_leaf) {
+            auto left_leaf = static_cast<leaf_type*>(left);
+            auto right_leaf = static_cast<leaf_type*>(right);
+            std::move(right->values, right->values + right->count, left->values + left->count);
+            left->count += right->count;
+
+            left_leaf->next = right_leaf->next;
+            if (right_leaf->next != nullptr) {
+                right_leaf->next->prev = left_leaf;
+            } else {
+                last_leaf_ = left_leaf;
+            }
+            delete right_leaf;
+        } else {
+            auto left_inner = static_cast<inner_type*>(left);
+            auto right_inner = static_cast<inner_type*>(right);
+            left->values[left->count] = std::move(parent->values[index]);
+            std::move(right->values, right->values + right->count,
+                      left->values + left->count + 1);
+            std::copy(right_inner->children, right_inner->children + right->count + 1,
+                      left_inner->children + left->count + 1);
+            left->count += right->count + 1;
+            delete right_inner;
+        }
+
+        std::move(parent->values + index + 1, parent->values + parent->count,
+                  parent->values + index);
+        std::copy(parent->children + index + 2, parent->children + parent->count + 1,
+                  parent->children + index + 1);
+        --parent->count;
+    }
+};
@@ -0,0 +1,305 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "MapForPoor.h"
+#include "ThreadPool.h"
+
+// Map for poor shared by many threads, whose updates never wait for a merge. Updates go
+// to a small sorted buffer, which is frozen into a run once it holds kBufferSize keys.
+// Runs are immutable and published as a version, the list of runs from the newest on.
+// Readers hold a shared lock only to look up the buffer and pin the current version,
+// and search the runs without it, so they wait only for a writer changing the buffer
+// or publishing a version, never for a search or a merge. A background thread
+// merges adjacent runs of similar size into a new version, so sizes grow geometrically
+// with age and there are O(log n) runs. Large merges are split into pieces at the same
+// keys of both runs and merged on the pool. Writers wait only when merges fall behind
+// by kMaxRuns runs.
+template<class A, class B, class Hash = std::hash<A>>
+class ConcurrentMapForPoor : private SortedRuns<A, B, Hash> {
+    using Base = SortedRuns<A, B, Hash>;
+    using typename Base::Item;
+    using typename Base::Run;
+    using Base::kUnlimited;
+    using Base::hash_key;
+    using Base::may_contain;
+    using Base::item_lower_bound;
+    using Base::merge_items;
+    using Base::build_filter;
+
+public:
+    // Without a pool every merge runs on the background thread alone
+    explicit ConcurrentMapForPoor(ThreadPool* pool = nullptr)
+            : pool_(pool), version_(std::make_shared<Version>()) {
+        worker_ = std::thread([this] { merge_loop(); });
+    }
+
+    ConcurrentMapForPoor(const ConcurrentMapForPoor&) = delete;
+    ConcurrentMapForPoor& operator=(const ConcurrentMapForPoor&) = delete;
+
+    ~ConcurrentMapForPoor() {
+        {
+            std::lock_guard<std::mutex> lock(merge_mutex_);
+            stopped_ = true;
+        }
+        has_work_.notify_one();
+        worker_.join();
+    }
+
+    bool contains(const A& key) const {
+        bool live = false;
+        find(key, [&live](const Item& item) { live = !item.erased; });
+        return live;
+    }
+
+    B operator[](const A& key) const {
+        std::optional<B> value;
+        find(key, [&value](const Item& item) {
+            if (!item.erased)
+                value = item.pair.second;
+        });
+        if (!value)
+            throw std::out_of_range("");
+        return *value;
+    }
+
+    // Replaces the value if the key is already there
+    void insert(const std::pair<A, B> &keyValPair) {
+        update({keyValPair, false});
+    }
+
+    // Returns false if there was no such key
+    bool erase(const A& key) {
+        return update({{key, B()}, true});
+    }
+
+    int size() const { return size_; }
+
+    // Blocks until the background thread finds nothing to merge
+    void wait_for_merges() {
+        std::unique_lock<std::mutex> lock(merge_mutex_);
+        merged_.wait(lock, [this] { return !merging_ && !dirty_; });
+    }
+
+private:
+    struct Version {
+        // Newest first
+        std::vector<std::shared_ptr<const Run>> runs;
+    };
+
+    static const size_t kBufferSize = 4096;
+    static const size_t kMaxRuns = 32;
+    // Merges of more items are split into pieces of about this size for the pool
+    static const size_t kMergePieceSize = 1 << 15;
+
+    ThreadPool* pool_;
+    std::atomic<size_t> size_{0};
+
+    // Guards buffer_ and version_; writers also take write_mutex_, so they may read
+    // buffer_ without mutex_
+    mutable std::shared_mutex mutex_;
+    std::mutex write_mutex_;
+    std::map<A, Item> buffer_;
+    std::shared_ptr<const Version> version_;
+
+    // A new run was published since the background thread last found nothing to merge
+    std::mutex merge_mutex_;
+    std::condition_variable has_work_;
+    std::condition_variable merged_;
+    bool dirty_ = false;
+    bool merging_ = false;
+    bool stopped_ = false;
+    std::thread worker_;
+
+    // Calls function(item) with the newest item of key, which may be a tombstone
+    template<class Function>
+    void find(const A& key, Function function) const {
+        std::shared_ptr<const Version> version;
+        {
+            std::shared_lock<std::shared_mutex> lock(mutex_);
+            auto found = buffer_.find(key);
+            if (found != buffer_.end()) {
+                function(found->second);
+                return;
+            }
+            version = version_;
+        }
+        auto hash = hash_key(key);
+        for (auto& run : version->runs) {
+            if (!may_contain(*run, hash))
+                continue;
+            auto own = item_lower_bound(*run, key);
+            if (own < run->items.size() && !(key < run->items[own].pair.first)) {
+                function(run->items[own]);
+                return;
+            }
+        }
+    }
+
+    bool update(Item item) {
+        std::lock_guard<std::mutex> write_lock(write_mutex_);
+        bool present = contains(item.pair.first);
+        if (item.erased && !present)
+            return false;
+        if (!present)
+            ++size_;
+        else if (item.erased)
+            --size_;
+        {
+            std::unique_lock<std::shared_mutex> lock(mutex_);
+            buffer_.insert_or_assign(item.pair.first, std::move(item));
+        }
+        if (buffer_.size() >= kBufferSize)
+            freeze();
+        return true;
+    }
+
+    // Publishes the buffer as the newest run, called under write_mutex_
+    void freeze() {
+        auto run = std::make_shared<Run>();
+        run->items.reserve(buffer_.size());
+        // Readers may still be looking at the buffer, so the items are copied
+        for (auto& entry : buffer_)
+            run->items.push_back(entry.second);
+        build_filter(*run);
+
+        auto version = std::make_shared<Version>();
+        std::map<A, Item> frozen;
+        std::shared_ptr<const Version> old;
+        {
+            std::unique_lock<std::shared_mutex> lock(mutex_);
+            version->runs.reserve(version_->runs.size() + 1);
+            version->runs.push_back(std::move(run));
+            version->runs.insert(version->runs.end(), version_->runs.begin(),
+                                 version_->runs.end());
+            old = std::exchange(version_, std::move(version));
+            frozen.swap(buffer_);
+        }
+
+        std::unique_lock<std::mutex> lock(merge_mutex_);
+        dirty_ = true;
+        has_work_.notify_one();
+        // Too many runs slow down every lookup, so the writer waits for the merges
+        merged_.wait(lock, [this] {
+            return runs_count() <= kMaxRuns || (!merging_ && !dirty_);
+        });
+    }
+
+    size_t runs_count() const {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        return version_->runs.size();
+    }
+
+    void merge_loop() {
+        while (true) {
+            std::shared_ptr<const Version> version;
+            {
+                std::shared_lock<std::shared_mutex> lock(mutex_);
+                version = version_;
+            }
+            auto index = pick_merge(*version);
+            if (index == kUnlimited) {
+                std::unique_lock<std::mutex> lock(merge_mutex_);
+                merging_ = false;
+                merged_.notify_all();
+                has_work_.wait(lock, [this] { return stopped_ || dirty_; });
+                if (stopped_)
+                    return;
+                dirty_ = false;
+                merging_ = true;
+                continue;
+            }
+            auto& newer = version->runs[index];
+            auto& older = version->runs[index + 1];
+            // Runs are only added in front, so the oldest run stays the oldest
+            auto drop_erased = index + 2 == version->runs.size();
+            replace(newer.get(), older.get(), merge(*newer, *older, drop_erased));
+
+            std::lock_guard<std::mutex> lock(merge_mutex_);
+            merged_.notify_all();
+            if (stopped_)
+                return;
+        }
+    }
+
+    // Newer run of the newest adjacent pair where it is at least half the older one,
+    // or kUnlimited. Without such a pair sizes more than double with every older run.
+    static size_t pick_merge(const Version& version) {
+        for (size_t index = 0; index + 1 < version.runs.size(); ++index) {
+            if (2 * version.runs[index]->items.size() >= version.runs[index + 1]->items.size())
+                return index;
+        }
+        return kUnlimited;
+    }
+
+    // Both runs are split at the same keys, so the items of a key meet in one piece
+    std::shared_ptr<const Run> merge(const Run& newer, const Run& older,
+                                     bool drop_erased) const {
+        auto total = newer.items.size() + older.items.size();
+        auto& larger = newer.items.size() < older.items.size() ? older.items : newer.items;
+        auto pieces = pool_ == nullptr ? 1 : std::max<size_t>(1, total / kMergePieceSize);
+        auto bound = [&](const Run& run, size_t piece) {
+            if (piece == pieces)
+                return run.items.data() + run.items.size();
+            if (piece == 0)
+                return run.items.data();
+            return run.items.data() + item_lower_bound(run,
+                    larger[larger.size() * piece / pieces].pair.first);
+        };
+        std::vector<std::vector<Item>> outputs(pieces);
+        auto merge_piece = [&](size_t piece) {
+            auto newer_first = bound(newer, piece), newer_last = bound(newer, piece + 1);
+            auto older_first = bound(older, piece), older_last = bound(older, piece + 1);
+            outputs[piece].reserve((newer_last - newer_first) + (older_last - older_first));
+            auto budget = kUnlimited;
+            merge_items(newer_first, newer_last, older_first, older_last, drop_erased,
+                        outputs[piece], budget);
+        };
+        if (pieces == 1) {
+            merge_piece(0);
+        } else {
+            pool_->ParallelFor(pieces, [&merge_piece](size_t begin, size_t end) {
+                for (; begin < end; ++begin)
+                    merge_piece(begin);
+            });
+        }
+
+        auto run = std::make_shared<Run>();
+        run->items = std::move(outputs[0]);
+        for (size_t piece = 1; piece < pieces; ++piece) {
+            run->items.insert(run->items.end(), std::make_move_iterator(outputs[piece].begin()),
+                              std::make_move_iterator(outputs[piece].end()));
+        }
+        if (!run->items.empty())
+            build_filter(*run);
+        return run;
+    }
+
+    // Publishes a version with the pair of runs replaced by merged, if it has any items
+    void replace(const Run* newer, const Run* older, std::shared_ptr<const Run> merged) {
+        auto version = std::make_shared<Version>();
+        std::shared_ptr<const Version> old;
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+        version->runs.reserve(version_->runs.size());
+        for (auto& run : version_->runs) {
+            if (run.get() == newer) {
+                if (!merged->items.empty())
+                    version->runs.push_back(std::move(merged));
+            } else if (run.get() != older) {
+                version->runs.push_back(run);
+            }
+        }
+        old = std::exchange(version_, std::move(version));
+    }
+};
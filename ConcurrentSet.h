@@ -0,0 +1,204 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+#include "PersistentSet.h"
+
+// Ordered set shared by many threads. Readers walk an immutable version of the tree
+// without locks; writers copy the search path under a mutex, publish the new root and
+// retire the old version. A retired version is freed by a later update, outside the
+// mutex, once every reader which could have seen it has left, so writers never wait
+// for readers.
+template <typename ValueType>
+class ConcurrentSet {
+public:
+    using key_type = ValueType;
+    using value_type = ValueType;
+    using size_type = size_t;
+    using node_type = NodePersistent<value_type>;
+
+    ConcurrentSet() = default;
+    ConcurrentSet(const ConcurrentSet<ValueType>&) = delete;
+    ConcurrentSet<ValueType>& operator=(const ConcurrentSet<ValueType>&) = delete;
+
+    ~ConcurrentSet()
+    {
+        for (const auto& retired : retired_) {
+            node_type::Release(retired.root);
+        }
+        node_type::Release(root_.load());
+    }
+
+    // Returns false if value was already there
+    bool insert(const ValueType& value) { return update(value, &node_type::Insert); }
+
+    // Returns false if value was not there
+    bool erase(const ValueType& value) { return update(value, &node_type::Erase); }
+
+    bool contains(const ValueType& value) const
+    {
+        ReadGuard guard(*this);
+        auto vertex = guard.root;
+        while (vertex != nullptr) {
+            if (value < vertex->value) {
+                vertex = vertex->left;
+            } else if (vertex->value < value) {
+                vertex = vertex->right;
+            } else {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    std::optional<ValueType> lower_bound(const ValueType& value) const
+    {
+        ReadGuard guard(*this);
+        const node_type* found = nullptr;
+        for (auto vertex = guard.root; vertex != nullptr;) {
+            if (!(vertex->value < value)) {
+                found = vertex;
+                vertex = vertex->left;
+            } else {
+                vertex = vertex->right;
+            }
+        }
+        return found == nullptr ? std::nullopt : std::make_optional(found->value);
+    }
+
+    std::optional<ValueType> upper_bound(const ValueType& value) const
+    {
+        ReadGuard guard(*this);
+        const node_type* found = nullptr;
+        for (auto vertex = guard.root; vertex != nullptr;) {
+            if (value < vertex->value) {
+                found = vertex;
+                vertex = vertex->left;
+            } else {
+                vertex = vertex->right;
+            }
+        }
+        return found == nullptr ? std::nullopt : std::make_optional(found->value);
+    }
+
+    // Consistent view for ordered scans, it is not affected by later updates
+    PersistentSet<ValueType> snapshot() const
+    {
+        ReadGuard guard(*this);
+        return PersistentSet<ValueType>(node_type::Retain(guard.root));
+    }
+
+    size_t size() const
+    {
+        ReadGuard guard(*this);
+        return node_type::GetSize(guard.root);
+    }
+    bool empty() const { return size() == 0; }
+
+private:
+    static const size_t kReaderSlots = 64;
+
+    // Readers of each epoch parity, one cache line per group of threads
+    struct alignas(64) ReaderSlot {
+        std::atomic<int64_t> readers[2] {};
+    };
+
+    // Replaced root and the epoch when it was replaced
+    struct Retired {
+        const node_type* root;
+        uint64_t epoch;
+    };
+
+    std::atomic<const node_type*> root_ { nullptr };
+    std::atomic<uint64_t> epoch_ { 0 };
+    mutable ReaderSlot slots_[kReaderSlots];
+    std::mutex writer_mutex_;
+    // Oldest first, guarded by writer_mutex_
+    std::deque<Retired> retired_;
+
+    static size_t this_thread_slot()
+    {
+        static std::atomic<size_t> next_slot { 0 };
+        static thread_local const size_t slot = next_slot.fetch_add(1) % kReaderSlots;
+        return slot;
+    }
+
+    // Registers the reader in the current epoch and pins the root published at that moment
+    class ReadGuard {
+    public:
+        explicit ReadGuard(const ConcurrentSet<ValueType>& set)
+        {
+            auto& slot = set.slots_[this_thread_slot()];
+            while (true) {
+                auto epoch = set.epoch_.load();
+                counter_ = &slot.readers[epoch & 1];
+                counter_->fetch_add(1);
+                if (set.epoch_.load() == epoch) {
+                    break;
+                }
+                counter_->fetch_sub(1);
+            }
+            root = set.root_.load();
+        }
+
+        ~ReadGuard()
+        {
+            counter_->fetch_sub(1);
+        }
+
+        ReadGuard(const ReadGuard&) = delete;
+        ReadGuard& operator=(const ReadGuard&) = delete;
+
+        const node_type* root;
+
+    private:
+        std::atomic<int64_t>* counter_;
+    };
+
+    template <typename Operation>
+    bool update(const ValueType& value, Operation operation)
+    {
+        std::vector<Retired> reclaimed;
+        {
+            std::lock_guard<std::mutex> lock(writer_mutex_);
+            auto old_root = root_.load();
+            auto new_root = operation(old_root, value);
+            if (new_root == old_root) {
+                node_type::Release(new_root);
+                return false;
+            }
+            root_.store(new_root);
+            // A reader which loaded old_root registered in this epoch or earlier
+            retired_.push_back({ old_root, epoch_.load() });
+            try_advance_epoch();
+            auto epoch = epoch_.load();
+            while (!retired_.empty() && retired_.front().epoch + 2 <= epoch) {
+                reclaimed.push_back(retired_.front());
+                retired_.pop_front();
+            }
+        }
+        for (const auto& retired : reclaimed) {
+            node_type::Release(retired.root);
+        }
+        return true;
+    }
+
+    // Moves from epoch e to e + 1 unless readers of e - 1, which share the counters of
+    // e + 1, are still there. So all readers have one of the last two epochs, and a
+    // root retired in epoch e is unreachable once the epoch is e + 2.
+    void try_advance_epoch()
+    {
+        auto epoch = epoch_.load();
+        for (auto& slot : slots_) {
+            if (slot.readers[(epoch + 1) & 1].load() != 0) {
+                return;
+            }
+        }
+        epoch_.store(epoch + 1);
+    }
+};
@@ -0,0 +1,220 @@
+#pragma once
+
+#include <algorithm>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "FixedSet.h"
+#include "ThreadPool.h"
+
+// FixedSet which takes updates. Inserts go to a small hash set and erases of built keys
+// to tombstones; once they outgrow a share of the built set, the perfect hash core is
+// rebuilt on the pool while queries and updates go on, then swapped in. Updates made
+// during a rebuild are replayed on top of the new core. A rebuild which fails, as when
+// distinct keys have equal hashes, keeps every update in the delta, and the next one
+// starts once the delta has doubled.
+template <typename Key = int, typename Hash = std::hash<Key>,
+          typename HashFamily = MultiplyShiftHashFamily>
+class DynamicFixedSet {
+public:
+    static constexpr double kDefaultRebuildRatio = 0.01;
+
+    // Without a pool rebuilds run on the updating thread
+    explicit DynamicFixedSet(ThreadPool* pool = nullptr,
+                             double rebuild_ratio = kDefaultRebuildRatio)
+            : pool_(pool)
+            , rebuild_ratio_(rebuild_ratio)
+    {
+    }
+
+    DynamicFixedSet(const DynamicFixedSet&) = delete;
+    DynamicFixedSet& operator=(const DynamicFixedSet&) = delete;
+
+    ~DynamicFixedSet()
+    {
+        WaitForRebuild();
+    }
+
+    void Initialize(const std::vector<Key>& elements)
+    {
+        WaitForRebuild();
+        FixedSet<Key, Hash, HashFamily> core;
+        core.Initialize(elements, pool_);
+        auto core_size = CountElements(core);
+
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+        core_ = std::move(core);
+        core_size_ = core_size;
+        inserted_.clear();
+        erased_.clear();
+        failed_delta_ = 0;
+    }
+
+    bool Contains(const Key& value) const
+    {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        return ContainsLocked(value);
+    }
+
+    // Returns false if value was already there
+    bool Insert(const Key& value) { return Update(value, true); }
+
+    // Returns false if value was not there
+    bool Erase(const Key& value) { return Update(value, false); }
+
+    size_t Size() const
+    {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        return core_size_ - erased_.size() + inserted_.size();
+    }
+
+    // Blocks until a running rebuild is swapped in
+    void WaitForRebuild()
+    {
+        std::shared_future<void> rebuild;
+        {
+            std::shared_lock<std::shared_mutex> lock(mutex_);
+            rebuild = rebuild_;
+        }
+        if (rebuild.valid()) {
+            pool_->Wait(rebuild);
+        }
+    }
+
+private:
+    // Delta is rebuilt into the core once it exceeds the larger of this and the ratio
+    static constexpr size_t kMinRebuildDelta = 1024;
+
+    ThreadPool* pool_;
+    double rebuild_ratio_;
+
+    mutable std::shared_mutex mutex_;
+    FixedSet<Key, Hash, HashFamily> core_;
+    size_t core_size_ = 0;
+    // Keys not in core_, and keys of core_ which were erased
+    std::unordered_set<Key, Hash> inserted_;
+    std::unordered_set<Key, Hash> erased_;
+    // Updates since the running rebuild took its snapshot, as (key, is insert)
+    bool rebuilding_ = false;
+    std::vector<std::pair<Key, bool>> log_;
+    // Delta size when the last rebuild failed, or zero
+    size_t failed_delta_ = 0;
+    std::shared_future<void> rebuild_;
+
+    bool ContainsLocked(const Key& value) const
+    {
+        if (inserted_.count(value) != 0) {
+            return true;
+        }
+        return core_.Contains(value) && erased_.count(value) == 0;
+    }
+
+    bool InsertLocked(const Key& value)
+    {
+        if (erased_.erase(value) != 0) {
+            return true;
+        }
+        if (core_.Contains(value)) {
+            return false;
+        }
+        return inserted_.insert(value).second;
+    }
+
+    bool EraseLocked(const Key& value)
+    {
+        if (inserted_.erase(value) != 0) {
+            return true;
+        }
+        if (!core_.Contains(value)) {
+            return false;
+        }
+        return erased_.insert(value).second;
+    }
+
+    bool Update(const Key& value, bool insert)
+    {
+        bool changed, rebuild_here = false;
+        {
+            std::unique_lock<std::shared_mutex> lock(mutex_);
+            changed = insert ? InsertLocked(value) : EraseLocked(value);
+            if (!changed) {
+                return false;
+            }
+            if (rebuilding_) {
+                log_.emplace_back(value, insert);
+            } else if (inserted_.size() + erased_.size() >
+                       std::max<size_t>({ kMinRebuildDelta,
+                                          static_cast<size_t>(core_size_ * rebuild_ratio_),
+                                          2 * failed_delta_ })) {
+                rebuilding_ = true;
+                if (pool_ != nullptr) {
+                    rebuild_ = pool_->Submit([this] { Rebuild(); }).share();
+                } else {
+                    rebuild_here = true;
+                }
+            }
+        }
+        if (rebuild_here) {
+            Rebuild();
+        }
+        return true;
+    }
+
+    void Rebuild()
+    {
+        FixedSet<Key, Hash, HashFamily> core;
+        std::vector<Key> elements;
+        try {
+            std::unordered_set<Key, Hash> erased;
+            {
+                std::shared_lock<std::shared_mutex> lock(mutex_);
+                core = core_;
+                elements.assign(inserted_.begin(), inserted_.end());
+                erased = erased_;
+            }
+            core.ForEach([&](const Key& key) {
+                if (erased.count(key) == 0) {
+                    elements.push_back(key);
+                }
+            });
+            core.Initialize(elements, pool_);
+        } catch (...) {
+            // The logged updates are already in the delta, which stays valid on top of
+            // the old core. Nothing is rethrown: the pool would keep the exception for
+            // WaitForRebuild, which runs in the destructor.
+            std::unique_lock<std::shared_mutex> lock(mutex_);
+            log_.clear();
+            rebuilding_ = false;
+            failed_delta_ = inserted_.size() + erased_.size();
+            return;
+        }
+
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+        core_ = std::move(core);
+        core_size_ = elements.size();
+        inserted_.clear();
+        erased_.clear();
+        for (const auto& [key, insert] : log_) {
+            if (insert) {
+                InsertLocked(key);
+            } else {
+                EraseLocked(key);
+            }
+        }
+        log_.clear();
+        rebuilding_ = false;
+        failed_delta_ = 0;
+    }
+
+    static size_t CountElements(const FixedSet<Key, Hash, HashFamily>& set)
+    {
+        size_t count = 0;
+        set.ForEach([&count](const Key&) { ++count; });
+        return count;
+    }
+};
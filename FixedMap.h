@@ -0,0 +1,63 @@
+#pragma once
+
+#include <functional>
+#include <utility>
+
+#include "FixedSet.h"
+
+// Slots of FixedMap keep the value right after the key, so it comes with the same
+// cache line. A plain struct rather than std::pair, so it can be serialized.
+template <typename Key, typename Value>
+struct MapSlotTraits {
+    using Element = std::pair<Key, Value>;
+
+    struct Slot {
+        Key key;
+        Value value;
+    };
+
+    static constexpr uint64_t kFileMagic = 0x50414d5f44455846ull;  // "FXED_MAP"
+
+    static const Key& KeyOf(const Slot& slot) { return slot.key; }
+    static const Key& KeyOf(const Element& element) { return element.first; }
+    static Slot MakeSlot(const Element& element) { return { element.first, element.second }; }
+};
+
+// Static map with the perfect hashing of FixedSet: Find reads one bucket and one slot
+// holding both the key and the value
+template <typename Key, typename Value, typename Hash = std::hash<Key>,
+          typename HashFamily = MultiplyShiftHashFamily>
+class FixedMap : private PerfectHashTable<Key, MapSlotTraits<Key, Value>, Hash, HashFamily> {
+    using Table = PerfectHashTable<Key, MapSlotTraits<Key, Value>, Hash, HashFamily>;
+    using Slot = typename MapSlotTraits<Key, Value>::Slot;
+
+public:
+    using Table::Initialize;
+    using Table::Open;
+    using Table::Serialize;
+    using Table::Statistics;
+
+    bool Contains(const Key& key) const { return Table::Find(key) != nullptr; }
+
+    // Value of key, or nullptr if it is not there
+    const Value* Find(const Key& key) const
+    {
+        auto slot = Table::Find(key);
+        return slot == nullptr ? nullptr : &slot->value;
+    }
+
+    // Calls function(key, value) for every element
+    template <typename Function>
+    void ForEach(Function function) const
+    {
+        Table::ForEach([&function](const Slot& slot) { function(slot.key, slot.value); });
+    }
+
+    // result[i] = Find(keys[i]), faster for maps which do not fit in cache
+    void FindBatch(const Key* keys, size_t count, const Value** result) const
+    {
+        Table::FindBatch(keys, count, [result](size_t index, const Slot* slot) {
+            result[index] = slot == nullptr ? nullptr : &slot->value;
+        });
+    }
+};
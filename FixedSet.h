@@ -1,12 +1,27 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <limits>
+#include <memory>
 #include <numeric>
-#include <optional>
 #include <random>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
-uint64_t SumSquares(const std::vector<uint64_t>& elements)
+#include "MappedFile.h"
+#include "MixBits.h"
+#include "ThreadPool.h"
+
+inline uint64_t SumSquares(const std::vector<uint64_t>& elements)
 {
     return std::accumulate(elements.begin(), elements.end(), static_cast<uint64_t>(0),
                            [](uint64_t total, uint64_t current) {
@@ -14,129 +29,591 @@ uint64_t SumSquares(const std::vector<uint64_t>& elements)
                            });
 }
 
+// (a * x + b) mod p mod m for the prime p = 2^64 + 13, which exceeds every point, so
+// distinct 64-bit points collide only for a small fraction of a and b
 class LinearHashFunction {
 public:
     LinearHashFunction(uint64_t linear_coefficient = 1, uint64_t free_term = 0,
-                       uint32_t prime_base = 3, uint32_t other_base = 2)
+                       uint32_t other_base = 1)
             : linear_coefficient_(linear_coefficient)
             , free_term_(free_term)
-            , prime_base_(prime_base)
             , other_base_(other_base)
     {
     }
 
     uint32_t operator()(uint64_t point) const
     {
-        uint32_t result = (point * linear_coefficient_ + free_term_) % prime_base_ % other_base_;
-        if (result < 0) {
-            result += prime_base_;
-        }
-        return result;
+        auto value = static_cast<unsigned __int128>(point) * linear_coefficient_ + free_term_;
+        return value % kPrimeBase % other_base_;
     }
 
+    static constexpr unsigned __int128 kPrimeBase = (static_cast<unsigned __int128>(1) << 64) + 13;
+
 private:
     uint64_t linear_coefficient_, free_term_;
-    uint32_t prime_base_, other_base_;
+    uint32_t other_base_;
 };
 
-LinearHashFunction GenerateRandomLinearHashFunction(uint32_t prime_base, uint32_t other_base)
+// Generator of the splitmix64 sequence: tiny state, so every bucket of a build can
+// have its own one seeded from the bucket index
+class SplitMix64 {
+public:
+    using result_type = uint64_t;
+
+    explicit SplitMix64(uint64_t seed)
+            : state_(seed)
+    {
+    }
+
+    static constexpr result_type min() { return 0; }
+    static constexpr result_type max() { return ~static_cast<result_type>(0); }
+
+    result_type operator()()
+    {
+        return MixBits(state_ += 0x9e3779b97f4a7c15ull);
+    }
+
+private:
+    uint64_t state_;
+};
+
+// Coefficients are drawn below 2^64 rather than p, so the product fits in 128 bits.
+// Zero coefficient sends every point to one place, so it is never drawn.
+template <typename Generator>
+LinearHashFunction GenerateRandomLinearHashFunction(uint32_t other_base, Generator& generator)
 {
-    static const int kGeneratorSeed = 228;
-    static std::mt19937 generator(kGeneratorSeed);
-    std::uniform_int_distribution<uint64_t> rand_1_p(0, prime_base - 1);
-    std::uniform_int_distribution<uint64_t> rand_0_p(0, prime_base - 1);
+    std::uniform_int_distribution<uint64_t> rand_1_p(1, std::numeric_limits<uint64_t>::max());
+    std::uniform_int_distribution<uint64_t> rand_0_p;
     auto linear_coefficient = rand_1_p(generator);
     auto free_term = rand_0_p(generator);
-    return LinearHashFunction(linear_coefficient, free_term, prime_base, other_base);
+    return LinearHashFunction(linear_coefficient, free_term, other_base);
+}
+
+// Top bits of a * x mod 2^64 for odd a, a pair of points collides with probability
+// at most 2 / m. No divisions, but table sizes must be powers of two.
+class MultiplyShiftHashFunction {
+public:
+    MultiplyShiftHashFunction(uint64_t multiplier = 0, uint32_t shift = 0)
+            : multiplier_(multiplier)
+            , shift_(shift)
+    {
+    }
+
+    uint32_t operator()(uint64_t point) const
+    {
+        return (point * multiplier_) >> shift_;
+    }
+
+private:
+    uint64_t multiplier_;
+    uint32_t shift_;
+};
+
+// Tables are indexed by uint32_t, so sizes above 2^31 are rejected
+inline uint32_t RoundUpToPowerOfTwo(uint64_t size)
+{
+    if (size > (static_cast<uint64_t>(1) << 31)) {
+        throw std::length_error("FixedSet: table of more than 2^31 slots");
+    }
+    uint64_t result = 1;
+    while (result < size) {
+        result <<= 1;
+    }
+    return result;
+}
+
+template <typename Generator>
+MultiplyShiftHashFunction GenerateRandomMultiplyShiftHashFunction(uint32_t other_base,
+                                                                  Generator& generator)
+{
+    // Shift by 64 is undefined, so a table of one slot gets the zero function
+    if (other_base == 1) {
+        return MultiplyShiftHashFunction(0, 0);
+    }
+    auto multiplier = generator() | 1;
+    auto shift = 64 - __builtin_ctz(other_base);
+    return MultiplyShiftHashFunction(multiplier, shift);
 }
 
-class FixedSet {
+// Hash families for FixedSet: TableSize rounds a wanted table size up to one the family
+// supports, Generate draws a random function onto [0, size)
+struct LinearHashFamily {
+    using Function = LinearHashFunction;
+
+    static uint32_t TableSize(uint64_t size)
+    {
+        if (size > std::numeric_limits<uint32_t>::max()) {
+            throw std::length_error("FixedSet: table of more than 2^32 - 1 slots");
+        }
+        return size;
+    }
+
+    template <typename Generator>
+    static Function Generate(uint32_t size, Generator& generator)
+    {
+        return GenerateRandomLinearHashFunction(size, generator);
+    }
+};
+
+struct MultiplyShiftHashFamily {
+    using Function = MultiplyShiftHashFunction;
+
+    static uint32_t TableSize(uint64_t size) { return RoundUpToPowerOfTwo(size); }
+
+    template <typename Generator>
+    static Function Generate(uint32_t size, Generator& generator)
+    {
+        return GenerateRandomMultiplyShiftHashFunction(size, generator);
+    }
+};
+
+// Work done by the last build of a PerfectHashTable, to watch and bound build time
+struct PerfectHashStatistics {
+    uint64_t seed = 0;
+    // Top level functions drawn until the second level tables fit the bound on slots
+    uint64_t top_level_attempts = 0;
+    // Second level functions drawn for all buckets, and for the worst one
+    uint64_t second_level_attempts = 0;
+    uint64_t max_bucket_attempts = 0;
+    uint64_t slots_count = 0;
+};
+
+// Slots of FixedSet are the keys themselves
+template <typename Key>
+struct SetSlotTraits {
+    using Element = Key;
+    using Slot = Key;
+
+    static constexpr uint64_t kFileMagic = 0x5445535f44455846ull;  // "FXED_SET"
+
+    static const Key& KeyOf(const Key& key) { return key; }
+    static const Slot& MakeSlot(const Element& element) { return element; }
+};
+
+// Two-level perfect hashing, the engine of FixedSet and FixedMap. Keys are hashed by Hash
+// to 64 bits first, then by universal functions, so distinct keys need distinct Hash
+// values: Initialize checks it and throws otherwise. All second level tables live in one
+// array of slots, so a lookup reads one bucket and one slot. SlotTraits defines what a
+// slot keeps besides the key.
+template <typename Key, typename SlotTraits, typename Hash, typename HashFamily>
+class PerfectHashTable {
 public:
-    void Initialize(const std::vector<int>& elements);
-    bool Contains(int value) const;
+    using Element = typename SlotTraits::Element;
+    using Slot = typename SlotTraits::Slot;
+
+    static constexpr uint64_t kDefaultSeed = 228;
+
+    // Runs on pool if it is given. The result depends only on elements and seed, not on
+    // the number of threads, and builds of different tables may run concurrently.
+    // Of equal keys the first one is kept. Throws std::invalid_argument if two distinct
+    // keys have equal Hash values, which no choice of the universal functions separates,
+    // and std::length_error if a table needs more slots than the family can index; either
+    // leaves the table empty.
+    void Initialize(const std::vector<Element>& elements, ThreadPool* pool = nullptr,
+                    uint64_t seed = kDefaultSeed);
+
+    // Of the last Initialize, empty for a table loaded by Open
+    const PerfectHashStatistics& Statistics() const { return statistics_; }
+
+    // Slot of value, or nullptr if it is not there
+    const Slot* Find(const Key& value) const;
+
+    // Calls output(i, Find(values[i])). Groups of queries are hashed together and their
+    // buckets and slots are prefetched, so the cache misses of a group overlap.
+    template <typename Output>
+    void FindBatch(const Key* values, size_t count, Output output) const;
+
+    // Calls function(slot) for every stored element once, skipping the free slots
+    template <typename Function>
+    void ForEach(Function function) const;
+
+    // Writes the tables as one flat file which Open maps back. Needs trivially copyable
+    // slots and a Hash giving the same values in every process.
+    void Serialize(const std::string& path) const;
+
+    // Answers queries right from the mapped pages of a file written by Serialize:
+    // nothing is read or copied until the first lookups touch it
+    void Open(const std::string& path);
 
 private:
-    class InnerHashTable {
-    public:
-        void Initialize(const std::vector<int>& elements);
-        bool Contains(int value) const;
-
-    private:
-        LinearHashFunction hash_function_;
-        std::vector<std::optional<int>> hash_table_;
-        bool HaveCollisionAndFill(const std::vector<int>& elements);
-        static const int kPrimeBase = 2'000'000'011;
+    using HashFunction = typename HashFamily::Function;
+
+    // Queries resolved together by FindBatch
+    static constexpr size_t kBatchSize = 64;
+
+    // Second level table of a bucket takes slots_[offset, offset + size)
+    struct Bucket {
+        uint64_t offset = 0;
+        uint32_t size = 0;
+        HashFunction hash_function;
     };
 
-    LinearHashFunction hash_function_;
-    std::vector<InnerHashTable> inner_hash_tables_;
-    static const int kPrimeBase = 2'000'000'011;
+    struct Tables {
+        std::vector<Bucket> buckets;
+        std::vector<Slot> slots;
+    };
+
+    // Serialized table is the header, the buckets and the slots, each aligned to
+    // kFileAlignment
+    struct FileHeader {
+        uint64_t magic;
+        uint64_t slot_size;
+        uint64_t bucket_size;
+        uint64_t buckets_count;
+        uint64_t slots_count;
+        HashFunction hash_function;
+    };
+
+    static constexpr uint64_t kFileAlignment = 64;
+
+    Hash hash_;
+    HashFunction hash_function_;
+    // Tables are immutable and owned by storage_, which is either Tables or MappedFile,
+    // so copies share them
+    const Bucket* buckets_ = nullptr;
+    uint64_t buckets_count_ = 0;
+    // Free slots repeat a key of their bucket placed elsewhere, so they never match
+    const Slot* slots_ = nullptr;
+    uint64_t slots_count_ = 0;
+    std::shared_ptr<const void> storage_;
+    PerfectHashStatistics statistics_;
+
+    // Places the keys of hashed[0, count) by the function of bucket
+    static bool HaveCollisionAndFill(const Bucket& bucket,
+                                     const std::pair<uint64_t, size_t>* hashed, size_t count,
+                                     const std::vector<Element>& elements, Slot* slots,
+                                     std::vector<bool>& occupied);
+
+    static uint64_t AlignUp(uint64_t offset)
+    {
+        return (offset + kFileAlignment - 1) / kFileAlignment * kFileAlignment;
+    }
+
+    template <typename Function>
+    static void ParallelFor(ThreadPool* pool, size_t count, Function function)
+    {
+        if (pool == nullptr) {
+            function(0, count);
+        } else {
+            pool->ParallelFor(count, function);
+        }
+    }
 };
 
-void FixedSet::Initialize(const std::vector<int>& elements)
+template <typename Key, typename SlotTraits, typename Hash, typename HashFamily>
+void PerfectHashTable<Key, SlotTraits, Hash, HashFamily>::Initialize(
+        const std::vector<Element>& elements, ThreadPool* pool, uint64_t seed)
 {
-    uint32_t hash_table_size = elements.size();
+    buckets_ = nullptr;
+    slots_ = nullptr;
+    buckets_count_ = slots_count_ = 0;
+    storage_.reset();
+    statistics_ = PerfectHashStatistics();
+    statistics_.seed = seed;
+    if (elements.empty()) {
+        return;
+    }
+
+    SplitMix64 generator(seed);
+    auto buckets_seed = generator();
+
+    std::vector<uint64_t> hashes(elements.size());
+    ParallelFor(pool, elements.size(), [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            hashes[i] = hash_(SlotTraits::KeyOf(elements[i]));
+        }
+    });
+
+    uint32_t hash_table_size = HashFamily::TableSize(elements.size());
     const int coefficient_hash_table_size = 8;
-    auto max_sum_squares_buckets_size = coefficient_hash_table_size * hash_table_size;
 
-    std::vector<uint64_t> buckets_size(elements.size());
+    // Bucket i gets (hash, index) pairs [begins[i], begins[i] + buckets_size[i]), sorted
+    // by hash and without duplicate keys, which would break the bound on bucket sizes
+    std::vector<std::pair<uint64_t, size_t>> hashed(elements.size());
+    std::vector<uint64_t> begins(hash_table_size + 1);
+    std::vector<uint64_t> buckets_size(hash_table_size);
+    std::vector<std::atomic<uint64_t>> positions(hash_table_size);
+    std::atomic<bool> hash_collision { false };
+    uint64_t elements_count;
     do {
-        hash_function_ = GenerateRandomLinearHashFunction(kPrimeBase, elements.size());
-        std::fill(buckets_size.begin(), buckets_size.end(), 0);
-        for (int x : elements) {
-            ++buckets_size[hash_function_(x)];
+        ++statistics_.top_level_attempts;
+        hash_function_ = HashFamily::Generate(hash_table_size, generator);
+        ParallelFor(pool, hash_table_size, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                positions[i].store(0, std::memory_order_relaxed);
+            }
+        });
+        ParallelFor(pool, elements.size(), [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                positions[hash_function_(hashes[i])].fetch_add(1, std::memory_order_relaxed);
+            }
+        });
+        for (uint32_t i = 0; i < hash_table_size; ++i) {
+            begins[i + 1] = begins[i] + positions[i].load(std::memory_order_relaxed);
+            positions[i].store(begins[i], std::memory_order_relaxed);
         }
-    } while (SumSquares(buckets_size) > max_sum_squares_buckets_size);
+        // Order inside a bucket depends on the threads until the bucket is sorted
+        ParallelFor(pool, elements.size(), [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                auto bucket = hash_function_(hashes[i]);
+                hashed[positions[bucket].fetch_add(1, std::memory_order_relaxed)] = {
+                    hashes[i], i
+                };
+            }
+        });
+        ParallelFor(pool, hash_table_size, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                auto first = hashed.begin() + begins[i], last = hashed.begin() + begins[i + 1];
+                std::sort(first, last);
+                last = std::unique(first, last, [&elements](const auto& left, const auto& right) {
+                    return left.first == right.first &&
+                           SlotTraits::KeyOf(elements[left.second]) ==
+                                   SlotTraits::KeyOf(elements[right.second]);
+                });
+                // Equal hashes left after the duplicate keys are gone belong to distinct keys
+                if (std::adjacent_find(first, last, [](const auto& left, const auto& right) {
+                        return left.first == right.first;
+                    }) != last) {
+                    hash_collision.store(true, std::memory_order_relaxed);
+                }
+                buckets_size[i] = last - first;
+            }
+        });
+        // Thrown here rather than from the pool, whose other tasks still use the lambdas
+        if (hash_collision.load(std::memory_order_relaxed)) {
+            throw std::invalid_argument("PerfectHashTable: distinct keys have equal hashes");
+        }
+        elements_count = std::accumulate(buckets_size.begin(), buckets_size.end(),
+                                         static_cast<uint64_t>(0));
+    } while (SumSquares(buckets_size) > coefficient_hash_table_size * elements_count);
 
-    std::vector<std::vector<int>> buckets(hash_table_size);
-    for (int number : elements) {
-        buckets[hash_function_(number)].push_back(number);
+    auto tables = std::make_shared<Tables>();
+    auto& buckets = tables->buckets;
+    auto& slots = tables->slots;
+    buckets.assign(hash_table_size, Bucket());
+    uint64_t slots_count = 0;
+    for (uint32_t i = 0; i < hash_table_size; ++i) {
+        buckets[i].offset = slots_count;
+        if (buckets_size[i] != 0) {
+            buckets[i].size = HashFamily::TableSize(buckets_size[i] * buckets_size[i]);
+        }
+        slots_count += buckets[i].size;
     }
+    slots.resize(slots_count);
+
+    // Every bucket draws its functions from its own generator, so the result does not
+    // depend on the number of threads
+    std::atomic<uint64_t> second_level_attempts { 0 };
+    std::atomic<uint64_t> max_bucket_attempts { 0 };
+    ParallelFor(pool, hash_table_size, [&](size_t begin, size_t end) {
+        std::vector<bool> occupied;
+        uint64_t attempts = 0, max_attempts = 0;
+        for (size_t i = begin; i < end; ++i) {
+            auto& bucket = buckets[i];
+            if (bucket.size == 0) {
+                continue;
+            }
+            SplitMix64 bucket_generator(buckets_seed + i);
+            uint64_t bucket_attempts = 0;
+            do {
+                ++bucket_attempts;
+                bucket.hash_function = HashFamily::Generate(bucket.size, bucket_generator);
+            } while (HaveCollisionAndFill(bucket, &hashed[begins[i]], buckets_size[i], elements,
+                                          slots.data(), occupied));
+            attempts += bucket_attempts;
+            max_attempts = std::max(max_attempts, bucket_attempts);
+            for (uint32_t slot = 0; slot < bucket.size; ++slot) {
+                if (!occupied[slot]) {
+                    slots[bucket.offset + slot] =
+                            SlotTraits::MakeSlot(elements[hashed[begins[i]].second]);
+                }
+            }
+        }
+        second_level_attempts += attempts;
+        auto current = max_bucket_attempts.load();
+        while (current < max_attempts &&
+               !max_bucket_attempts.compare_exchange_weak(current, max_attempts)) {
+        }
+    });
+    statistics_.second_level_attempts = second_level_attempts;
+    statistics_.max_bucket_attempts = max_bucket_attempts;
+    statistics_.slots_count = slots_count;
+
+    buckets_ = buckets.data();
+    buckets_count_ = buckets.size();
+    slots_ = slots.data();
+    slots_count_ = slots.size();
+    storage_ = std::move(tables);
+}
 
-    inner_hash_tables_.assign(hash_table_size, InnerHashTable());
-    for (size_t i = 0; i < inner_hash_tables_.size(); ++i) {
-        inner_hash_tables_[i].Initialize(buckets[i]);
+template <typename Key, typename SlotTraits, typename Hash, typename HashFamily>
+auto PerfectHashTable<Key, SlotTraits, Hash, HashFamily>::Find(const Key& value) const
+        -> const Slot*
+{
+    if (buckets_count_ == 0) {
+        return nullptr;
     }
+    auto hash = hash_(value);
+    const auto& bucket = buckets_[hash_function_(hash)];
+    if (bucket.size == 0) {
+        return nullptr;
+    }
+    const auto& slot = slots_[bucket.offset + bucket.hash_function(hash)];
+    return SlotTraits::KeyOf(slot) == value ? &slot : nullptr;
 }
 
-bool FixedSet::Contains(int value) const
+template <typename Key, typename SlotTraits, typename Hash, typename HashFamily>
+template <typename Output>
+void PerfectHashTable<Key, SlotTraits, Hash, HashFamily>::FindBatch(const Key* values,
+                                                                    size_t count,
+                                                                    Output output) const
 {
-    if (inner_hash_tables_.empty()) {
-        return false;
+    if (buckets_count_ == 0) {
+        for (size_t i = 0; i < count; ++i) {
+            output(i, static_cast<const Slot*>(nullptr));
+        }
+        return;
+    }
+    // Each stage is a loop without dependent loads, so hashing vectorizes and the
+    // prefetches of the whole group are in flight before the next stage reads them
+    uint64_t hashes[kBatchSize];
+    uint64_t places[kBatchSize];
+    const uint64_t no_slot = slots_count_;
+    for (size_t begin = 0; begin < count; begin += kBatchSize) {
+        auto size = std::min(kBatchSize, count - begin);
+        for (size_t i = 0; i < size; ++i) {
+            hashes[i] = hash_(values[begin + i]);
+        }
+        for (size_t i = 0; i < size; ++i) {
+            places[i] = hash_function_(hashes[i]);
+            __builtin_prefetch(&buckets_[places[i]]);
+        }
+        for (size_t i = 0; i < size; ++i) {
+            const auto& bucket = buckets_[places[i]];
+            places[i] = bucket.size == 0 ? no_slot
+                                         : bucket.offset + bucket.hash_function(hashes[i]);
+            __builtin_prefetch(slots_ + places[i]);
+        }
+        for (size_t i = 0; i < size; ++i) {
+            const Slot* slot = nullptr;
+            if (places[i] != no_slot && SlotTraits::KeyOf(slots_[places[i]]) == values[begin + i]) {
+                slot = slots_ + places[i];
+            }
+            output(begin + i, slot);
+        }
     }
-    auto bucket_number = hash_function_(value);
-    return inner_hash_tables_[bucket_number].Contains(value);
 }
 
-bool FixedSet::InnerHashTable::HaveCollisionAndFill(const std::vector<int>& elements)
+template <typename Key, typename SlotTraits, typename Hash, typename HashFamily>
+template <typename Function>
+void PerfectHashTable<Key, SlotTraits, Hash, HashFamily>::ForEach(Function function) const
 {
-    std::fill(hash_table_.begin(), hash_table_.end(), std::optional<int>());
-    bool have_collisions = false;
-    for (size_t i = 0; i < elements.size() && !have_collisions; ++i) {
-        auto hash = InnerHashTable::hash_function_(elements[i]);
-        if (hash_table_[hash].has_value() && hash_table_[hash] != elements[i]) {
-            have_collisions = true;
-        } else {
-            hash_table_[hash] = std::make_optional(elements[i]);
+    // A free slot repeats a key of its bucket, which the bucket function sends elsewhere
+    for (uint64_t i = 0; i < buckets_count_; ++i) {
+        const auto& bucket = buckets_[i];
+        for (uint64_t slot = 0; slot < bucket.size; ++slot) {
+            const auto& current = slots_[bucket.offset + slot];
+            if (bucket.hash_function(hash_(SlotTraits::KeyOf(current))) == slot) {
+                function(current);
+            }
         }
     }
-    return have_collisions;
 }
 
-void FixedSet::InnerHashTable::Initialize(const std::vector<int>& elements)
+template <typename Key, typename SlotTraits, typename Hash, typename HashFamily>
+void PerfectHashTable<Key, SlotTraits, Hash, HashFamily>::Serialize(const std::string& path) const
 {
-    if (elements.empty()) {
-        return;
+    static_assert(std::is_trivially_copyable_v<Slot>, "Slots are written byte by byte");
+    FileHeader header {};
+    header.magic = SlotTraits::kFileMagic;
+    header.slot_size = sizeof(Slot);
+    header.bucket_size = sizeof(Bucket);
+    header.buckets_count = buckets_count_;
+    header.slots_count = slots_count_;
+    header.hash_function = hash_function_;
+
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    auto write_aligned = [&out](const void* data, uint64_t size) {
+        out.write(static_cast<const char*>(data), size);
+        static const char kZeros[kFileAlignment] = {};
+        out.write(kZeros, AlignUp(size) - size);
+    };
+    write_aligned(&header, sizeof(header));
+    write_aligned(buckets_, buckets_count_ * sizeof(Bucket));
+    write_aligned(slots_, slots_count_ * sizeof(Slot));
+    if (!out.flush()) {
+        throw std::runtime_error("PerfectHashTable: cannot write " + path);
     }
-    auto hash_table_size = elements.size() * elements.size();
-    hash_table_.resize(hash_table_size);
-    do {
-        InnerHashTable::hash_function_ =
-                GenerateRandomLinearHashFunction(kPrimeBase, hash_table_size);
-    } while (HaveCollisionAndFill(elements));
 }
 
-bool FixedSet::InnerHashTable::Contains(int value) const
+template <typename Key, typename SlotTraits, typename Hash, typename HashFamily>
+void PerfectHashTable<Key, SlotTraits, Hash, HashFamily>::Open(const std::string& path)
 {
-    return !hash_table_.empty() && hash_table_[hash_function_(value)] == value;
+    static_assert(std::is_trivially_copyable_v<Slot>, "Slots are read byte by byte");
+    auto file = std::make_shared<MappedFile>(path);
+    FileHeader header;
+    if (file->Size() < sizeof(header)) {
+        throw std::runtime_error("PerfectHashTable: " + path + " is too short");
+    }
+    std::memcpy(&header, file->Data(), sizeof(header));
+    auto buckets_offset = AlignUp(sizeof(header));
+    auto slots_offset = buckets_offset + AlignUp(header.buckets_count * sizeof(Bucket));
+    if (header.magic != SlotTraits::kFileMagic || header.slot_size != sizeof(Slot) ||
+        header.bucket_size != sizeof(Bucket) ||
+        file->Size() < slots_offset + header.slots_count * sizeof(Slot)) {
+        throw std::runtime_error("PerfectHashTable: " + path +
+                                 " is not a serialized table of this type");
+    }
+
+    hash_function_ = header.hash_function;
+    statistics_ = PerfectHashStatistics();
+    buckets_ = reinterpret_cast<const Bucket*>(file->Data() + buckets_offset);
+    buckets_count_ = header.buckets_count;
+    slots_ = reinterpret_cast<const Slot*>(file->Data() + slots_offset);
+    slots_count_ = header.slots_count;
+    storage_ = std::move(file);
 }
+
+template <typename Key, typename SlotTraits, typename Hash, typename HashFamily>
+bool PerfectHashTable<Key, SlotTraits, Hash, HashFamily>::HaveCollisionAndFill(
+        const Bucket& bucket, const std::pair<uint64_t, size_t>* hashed, size_t count,
+        const std::vector<Element>& elements, Slot* slots, std::vector<bool>& occupied)
+{
+    occupied.assign(bucket.size, false);
+    bool have_collisions = false;
+    for (size_t i = 0; i < count && !have_collisions; ++i) {
+        auto slot = bucket.hash_function(hashed[i].first);
+        if (occupied[slot]) {
+            have_collisions = true;
+        } else {
+            occupied[slot] = true;
+            slots[bucket.offset + slot] = SlotTraits::MakeSlot(elements[hashed[i].second]);
+        }
+    }
+    return have_collisions;
+}
+
+// Static set answering Contains in at most two cache misses, built by two-level perfect
+// hashing over PerfectHashTable
+template <typename Key = int, typename Hash = std::hash<Key>,
+          typename HashFamily = MultiplyShiftHashFamily>
+class FixedSet : private PerfectHashTable<Key, SetSlotTraits<Key>, Hash, HashFamily> {
+    using Table = PerfectHashTable<Key, SetSlotTraits<Key>, Hash, HashFamily>;
+
+public:
+    using Table::ForEach;
+    using Table::Initialize;
+    using Table::Open;
+    using Table::Serialize;
+    using Table::Statistics;
+
+    bool Contains(const Key& value) const { return this->Find(value) != nullptr; }
+
+    // result[i] = Contains(values[i]), faster for sets which do not fit in cache
+    void ContainsBatch(const Key* values, size_t count, uint8_t* result) const
+    {
+        this->FindBatch(values, count, [result](size_t index, const Key* slot) {
+            result[index] = slot != nullptr;
+        });
+    }
+};
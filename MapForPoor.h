@@ -1,68 +1,994 @@
 #pragma once
 
 #include <algorithm>
-#include <list>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <numeric>
 #include <stdexcept>
+#include <string>
+#include <system_error>
+#include <type_traits>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
-template<class A, class B>
-class MapForPoor {
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "MappedFile.h"
+#include "MixBits.h"
+
+// Sorted runs of items with a blocked Bloom filter each, the storage of the maps for poor
+template<class A, class B, class Hash>
+class SortedRuns {
+protected:
+    struct Item {
+        std::pair<A, B> pair;
+        bool erased;
+    };
+
+    struct Bridge {
+        A key;
+        // Lower bounds of key in the items of the run and in the next cascade,
+        // the latter rounded up to a sampled position
+        size_t own;
+        size_t down;
+    };
+
+    struct alignas(64) FilterBlock {
+        uint64_t words[8];
+    };
+
+    struct Run {
+        std::vector<Item> items;
+        // Empty unless the run takes part in fractional cascading
+        std::vector<Bridge> cascade;
+        std::vector<FilterBlock> filter;
+        // Run whose cascade this one samples, the next older non-empty one
+        const Run* next = nullptr;
+        size_t step = 1;
+        // Bridge::down of the position past the end of the cascade
+        size_t end_down = 0;
+    };
+
+    // About 1% false positives
+    static const size_t kFilterBitsPerKey = 10;
+    static const int kFilterProbes = 6;
+    static constexpr size_t kUnlimited = std::numeric_limits<size_t>::max();
+    // Keys need only < to be stored. Without a usable Hash, such as void or std::hash
+    // of a pair, runs get empty filters which pass every key.
+    static constexpr bool kFiltered = std::is_default_constructible_v<Hash>;
+
+    struct NoHash {};
+    std::conditional_t<kFiltered, Hash, NoHash> hash_;
+
+    // Mixed, as std::hash of integers is the identity
+    uint64_t hash_key(const A& key) const {
+        if constexpr (kFiltered) {
+            return MixBits(hash_(key));
+        } else {
+            return 0;
+        }
+    }
+
+    static size_t filter_blocks(size_t items) {
+        return kFiltered ? std::max<size_t>(1, items * kFilterBitsPerKey / 512) : 0;
+    }
+
+    // High half of the hash picks the block, the low half gives the probed bits
+    template<class Function>
+    static void for_each_probe(size_t blocks, uint64_t hash, Function function) {
+        auto block = ((hash >> 32) * blocks) >> 32;
+        auto bits = static_cast<uint32_t>(hash) * 0x9e3779b97f4a7c15ull;
+        for (int probe = 0; probe < kFilterProbes; ++probe, bits >>= 9)
+            function(block, (bits >> 6) & 7, bits & 63);
+    }
+
+    static bool may_contain(const FilterBlock* filter, size_t blocks, uint64_t hash) {
+        if (!kFiltered)
+            return true;
+        bool found = true;
+        for_each_probe(blocks, hash, [&](size_t block, size_t word, size_t bit) {
+            found &= (filter[block].words[word] >> bit) & 1;
+        });
+        return found;
+    }
+
+    static bool may_contain(const Run& run, uint64_t hash) {
+        return may_contain(run.filter.data(), run.filter.size(), hash);
+    }
+
+    static void add_to_filter(std::vector<FilterBlock>& filter, uint64_t hash) {
+        if (!kFiltered)
+            return;
+        for_each_probe(filter.size(), hash, [&](size_t block, size_t word, size_t bit) {
+            filter[block].words[word] |= uint64_t(1) << bit;
+        });
+    }
+
+    // First element of [first, last) for which less(element) is false. The loop runs
+    // log2 of the size times whatever the keys are, halving by a conditional move
+    // instead of a branch the keys make unpredictable, and prefetches both probes of
+    // the next round, so the cache misses of consecutive rounds overlap.
+    template<class T, class Less>
+    static const T* branchless_lower_bound(const T* first, const T* last, Less less) {
+        size_t size = last - first;
+        if (size == 0)
+            return first;
+        while (size > 1) {
+            auto half = size / 2;
+            auto next_half = (size - half) / 2;
+            __builtin_prefetch(first + next_half);
+            __builtin_prefetch(first + half + next_half);
+            first = less(first[half]) ? first + half : first;
+            size -= half;
+        }
+        return first + less(*first);
+    }
+
+    // First item of [first, last) not less than key
+    static const Item* item_lower_bound(const Item* first, const Item* last, const A& key) {
+        return branchless_lower_bound(first, last,
+                [&key](const Item& item) { return item.pair.first < key; });
+    }
+
+    // Position of the first item of run not less than key
+    static size_t item_lower_bound(const Run& run, const A& key) {
+        auto first = run.items.data();
+        return item_lower_bound(first, first + run.items.size(), key) - first;
+    }
+
+    // Merges from the cursors on, spending a unit of budget per item taken, and returns
+    // true once both are at the end. Newer items shadow older items with the same key.
+    // Items are moved unless Pointer is a pointer to const.
+    template<class Pointer>
+    static bool merge_items(Pointer& newer, Pointer newer_end, Pointer& older,
+                            Pointer older_end, bool drop_erased, std::vector<Item>& output,
+                            size_t& budget) {
+        for (; budget > 0 && (newer != newer_end || older != older_end); --budget) {
+            Pointer item;
+            if (older == older_end ||
+                    (newer != newer_end && !(older->pair.first < newer->pair.first))) {
+                if (older != older_end && !(newer->pair.first < older->pair.first))
+                    ++older;
+                item = newer++;
+            } else {
+                item = older++;
+            }
+            if (!drop_erased || !item->erased)
+                output.push_back(std::move(*item));
+        }
+        return newer == newer_end && older == older_end;
+    }
+
+    // Moves both whole runs into output, which it clears first, and clears older
+    static void merge_items(Item* newer, Item* newer_end, std::vector<Item>& older,
+                            bool drop_erased, std::vector<Item>& output) {
+        output.clear();
+        auto older_first = older.data();
+        auto budget = kUnlimited;
+        merge_items(newer, newer_end, older_first, older.data() + older.size(),
+                    drop_erased, output, budget);
+        older.clear();
+    }
+
+    static void start_filter(Run& run) {
+        run.filter.assign(filter_blocks(run.items.size()), FilterBlock{});
+    }
+
+    // Adds keys from the cursor on, a unit of budget each, returns true when done
+    bool extend_filter(Run& run, size_t& hashed, size_t& budget) const {
+        if (!kFiltered)
+            hashed = run.items.size();
+        for (; hashed < run.items.size(); ++hashed, --budget) {
+            if (budget == 0)
+                return false;
+            add_to_filter(run.filter, hash_key(run.items[hashed].pair.first));
+        }
+        return true;
+    }
+
+    void build_filter(Run& run) const {
+        size_t hashed = 0, budget = kUnlimited;
+        start_filter(run);
+        extend_filter(run, hashed, budget);
+    }
+};
+
+// Level k is empty or keeps a sorted run of at most 2^k items, so an update merges
+// levels the way a carry runs through a binary counter. Every level owns a buffer of
+// capacity 2^k which is kept when the level is emptied, and merges move the items.
+//
+// Every run has a blocked Bloom filter of its keys, one cache line per key. A lookup
+// checks all filters first: a miss usually ends there, a single passed filter leads to
+// a plain search of its run, and otherwise the runs whose filter passed are searched
+// from the newest on. Searches are branch-free.
+//
+// Keys without a usable Hash get no filters, and their lookups use fractional cascading
+// instead: each run keeps a cascade, its keys merged with every step-th key of the
+// cascade of the next older run. A position in one cascade narrows the search in the
+// next one to step keys, so a lookup is one binary search of the newest cascade and
+// O(log step) per run, O(log n) in total. All levels below a merged one are empty, so
+// an update only builds the cascade of its target level. With filters the cascades
+// would not speed lookups up, as the filters leave about one run to search, and would
+// slow inserts down and take up to twice the items in memory.
+//
+// Erase adds a tombstone and insert of a present key adds a newer pair. Merges keep the
+// newest item of a key and drop tombstones once no older level is left. When stored
+// items outnumber live keys kCompactionRatio times, all levels are merged into one.
+//
+// In incremental mode no update waits for a large merge. A level keeps up to two runs,
+// and once it has two, a job merges them into a run for the next level a few items per
+// update, while lookups still read the old runs. A job of level k lasts 2^k updates,
+// ending right before the next run reaches the level, so every update does O(log n)
+// merge work, and the merged runs are destroyed a few items per update as well. Updates
+// also look their key up, which here may binary search two runs per level, so an update
+// takes O(log^2 n) in the worst case. A finished job would change the cascades of all
+// newer runs at once, so this mode builds none: lookups binary search every run whose
+// filter passes, and levels are not compacted.
+//
+// Given a directory, the levels too large for the memory budget keep their run in a
+// file, the items followed by the filter, which is mapped back for lookups. A merge into
+// such a level streams the carry and the levels on disk one by one, each into a new file
+// written sequentially. These levels take no part in cascading: lookups search them
+// after all levels in memory. Such maps are not compacted either.
+template<class A, class B, class Hash = std::hash<A>>
+class MapForPoor : private SortedRuns<A, B, Hash> {
+    using Base = SortedRuns<A, B, Hash>;
+    using typename Base::Item;
+    using typename Base::Bridge;
+    using typename Base::Run;
+    using typename Base::FilterBlock;
+    using Base::kFiltered;
+    using Base::kUnlimited;
+    using Base::hash_key;
+    using Base::filter_blocks;
+    using Base::may_contain;
+    using Base::add_to_filter;
+    using Base::branchless_lower_bound;
+    using Base::item_lower_bound;
+    using Base::merge_items;
+    using Base::start_filter;
+    using Base::extend_filter;
+    using Base::build_filter;
+
 public:
-    bool contains(const A& key) const {
-        for (auto& sorted : sets) {
-            int left = 0, right = sorted.size();
-            while (right - left > 1) {
-                int mid = (left + right) / 2;
-                if (key < sorted[mid].first)
-                    right = mid;
-                else 
-                    left = mid;
+    explicit MapForPoor(bool incremental = false) : incremental_(incremental) {}
+
+    // Levels of more than memory_items items go to files in directory, so memory keeps
+    // less than 2 * memory_items items. Needs trivially copyable keys and values.
+    MapForPoor(std::string directory, size_t memory_items)
+            : incremental_(false), directory_(std::move(directory)) {
+        static_assert(std::is_trivially_copyable_v<A> && std::is_trivially_copyable_v<B>,
+                      "Items are written byte by byte");
+        disk_level_ = 0;
+        while ((size_t(1) << disk_level_) <= memory_items)
+            ++disk_level_;
+    }
+
+    // Copies the runs and the merges in progress. Levels on disk own their files, so a
+    // map which has any throws std::logic_error.
+    MapForPoor(const MapForPoor& other)
+            : Base(other), incremental_(other.incremental_), directory_(other.directory_),
+              disk_level_(other.disk_level_), size_(other.size_), stored_(other.stored_) {
+        std::unordered_map<const Run*, const Run*> copies;
+        auto copy = [&copies](const Run& run) {
+            auto result = std::make_unique<Run>(run);
+            copies[&run] = result.get();
+            return result;
+        };
+        levels_.resize(other.levels_.size());
+        for (size_t index = 0; index < levels_.size(); ++index) {
+            auto& from = other.levels_[index];
+            auto& to = levels_[index];
+            if (from.disk)
+                throw std::logic_error("MapForPoor: levels on disk cannot be copied");
+            for (auto& run : from.runs)
+                to.runs.push_back(copy(*run));
+            if (from.job) {
+                auto& job = *from.job;
+                to.job = std::make_unique<Job>();
+                to.job->newer = copies.at(job.newer);
+                to.job->older = copies.at(job.older);
+                to.job->result = std::make_unique<Run>(*job.result);
+                to.job->newer_cursor = to.job->newer->items.data() +
+                                       (job.newer_cursor - job.newer->items.data());
+                to.job->older_cursor = to.job->older->items.data() +
+                                       (job.older_cursor - job.older->items.data());
+                to.job->hashed = job.hashed;
+                to.job->drop_erased = job.drop_erased;
+                to.job->work = job.work;
+                to.job->updates_left = job.updates_left;
+            }
+        }
+        for (auto& level : levels_) {
+            for (auto& run : level.runs) {
+                if (run->next != nullptr)
+                    run->next = copies.at(run->next);
             }
-            if (sorted[left].first == key)
-                return true;
         }
-        return false;
+    }
+
+    MapForPoor(MapForPoor&&) = default;
+    MapForPoor& operator=(MapForPoor&&) = default;
+
+    MapForPoor& operator=(const MapForPoor& other) {
+        if (this != &other)
+            *this = MapForPoor(other);
+        return *this;
+    }
+
+    bool contains(const A& key) const {
+        auto found = find(key);
+        return found != nullptr && !found->erased;
     }
 
     B operator[](const A& key) const {
-        for (auto& sorted : sets) {
-            int left = 0, right = sorted.size();
-            while (right - left > 1) {
-                int mid = (left + right) / 2;
-                if (key < sorted[mid].first)
-                    right = mid;
+        auto found = find(key);
+        if (found == nullptr || found->erased)
+            throw std::out_of_range("");
+        return found->pair.second;
+    }
+
+    // Replaces the value if the key is already there
+    void insert(const std::pair<A, B> &keyValPair) {
+        bool present = contains(keyValPair.first);
+        add({keyValPair, false});
+        if (!present)
+            ++size_;
+    }
+
+    // Returns false if there was no such key
+    bool erase(const A& key) {
+        if (!contains(key))
+            return false;
+        add({{key, B()}, true});
+        --size_;
+        return true;
+    }
+
+    int size() const { return size_; }
+
+    // result[i] = contains(keys[i]). The keys are sorted once, and then every run, the
+    // newest first, is walked by one galloping pass over the keys still unresolved.
+    void contains_batch(const A* keys, size_t count, uint8_t* result) const {
+        find_batch(keys, count, [result](size_t index, const Item* item) {
+            result[index] = item != nullptr && !item->erased;
+        });
+    }
+
+    // result[i] points to the value of keys[i], or is nullptr if there is no such key.
+    // Pointers are valid until the next update.
+    void get_batch(const A* keys, size_t count, const B** result) const {
+        find_batch(keys, count, [result](size_t index, const Item* item) {
+            result[index] = item == nullptr || item->erased ? nullptr : &item->pair.second;
+        });
+    }
+
+    // Live pairs in key order, merged from all runs by a heap of cursors which yields
+    // the newest item of every key. Any update invalidates iterators.
+    class const_iterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = std::pair<A, B>;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const value_type*;
+        using reference = const value_type&;
+
+        const_iterator() = default;
+
+        reference operator*() const { return heap_.front().item->pair; }
+        pointer operator->() const { return &heap_.front().item->pair; }
+
+        const_iterator& operator++() {
+            skip_key();
+            skip_erased();
+            return *this;
+        }
+
+        const_iterator operator++(int) {
+            auto copy = *this;
+            ++*this;
+            return copy;
+        }
+
+        // The newest item of a key is the same for every iterator standing at it
+        bool operator==(const const_iterator& other) const { return current() == other.current(); }
+        bool operator!=(const const_iterator& other) const { return current() != other.current(); }
+
+    private:
+        friend class MapForPoor;
+
+        struct Cursor {
+            const Item* item;
+            const Item* end;
+            // Position of the run from the newest one
+            size_t age;
+        };
+
+        std::vector<Cursor> heap_;
+
+        // The top of the heap has the least key, and the newest run among equal keys
+        static bool later(const Cursor& lhs, const Cursor& rhs) {
+            if (lhs.item->pair.first < rhs.item->pair.first)
+                return false;
+            return rhs.item->pair.first < lhs.item->pair.first || lhs.age > rhs.age;
+        }
+
+        const Item* current() const { return heap_.empty() ? nullptr : heap_.front().item; }
+
+        // Moves every cursor standing at the key of the top past it. Items stay in their
+        // runs, so the key is not copied.
+        void skip_key() {
+            const A& key = heap_.front().item->pair.first;
+            while (!heap_.empty() && !(key < heap_.front().item->pair.first)) {
+                std::pop_heap(heap_.begin(), heap_.end(), later);
+                auto& cursor = heap_.back();
+                if (++cursor.item == cursor.end)
+                    heap_.pop_back();
                 else
-                    left = mid;
+                    std::push_heap(heap_.begin(), heap_.end(), later);
             }
-            if (sorted[left].first == key)
-                return sorted[left].second;
         }
-        throw std::out_of_range("");
+
+        void skip_erased() {
+            while (!heap_.empty() && heap_.front().item->erased)
+                skip_key();
+        }
+    };
+
+    const_iterator begin() const { return make_iterator(nullptr); }
+    const_iterator end() const { return const_iterator(); }
+
+    // First live pair with a key not less than key
+    const_iterator lower_bound(const A& key) const { return make_iterator(&key); }
+
+    // Calls function(pair) for the live pairs with lo <= key < hi in key order
+    template<class Function>
+    void range(const A& lo, const A& hi, Function function) const {
+        for (auto iterator = lower_bound(lo); iterator != end() && iterator->first < hi;
+                ++iterator)
+            function(*iterator);
     }
 
-    void insert(const std::pair<A, B> &keyValPair) {
-        ++size_;
-        sets.insert(sets.begin(), { keyValPair });
-        if (sets.size() == 1)
-            return;
-        auto it_first = sets.begin();
-        auto it_second = ++sets.begin();
-        while (it_second != sets.end() && it_first->size() == it_second->size()) {
-            auto new_first = sets.insert(it_first, std::vector<std::pair<A, B>>());
-            std::merge(it_first->begin(), it_first->end(), 
-                    it_second->begin(), it_second->end(),
-                    std::back_inserter(*new_first));
-            sets.erase(it_first);
-            sets.erase(it_second);
-            it_first = new_first;
-            it_second = std::next(it_first);
+private:
+    // Merge of the two oldest runs of a level into a run for the next level
+    struct Job {
+        const Run* newer;
+        const Run* older;
+        std::unique_ptr<Run> result;
+        const Item* newer_cursor;
+        const Item* older_cursor;
+        size_t hashed = 0;
+        bool drop_erased;
+        // Bound of the units left: items merged and keys put in the filter
+        size_t work;
+        size_t updates_left;
+    };
+
+    // Run of a level on disk, owns its file and removes it when dropped
+    struct DiskRun {
+        std::string path;
+        std::unique_ptr<MappedFile> file;
+        const Item* items;
+        size_t size;
+        const FilterBlock* filter;
+        size_t blocks;
+
+        ~DiskRun() {
+            file.reset();
+            if (!path.empty())
+                std::remove(path.c_str());
         }
+    };
+
+    struct FileHeader {
+        uint64_t magic;
+        uint64_t item_size;
+        uint64_t items_count;
+        uint64_t blocks_count;
+    };
+
+    struct Level {
+        // Oldest first; the amortized mode keeps exactly one run and reuses it
+        std::vector<std::unique_ptr<Run>> runs;
+        std::unique_ptr<Job> job;
+        // Replaces the items of runs[0] on the levels from disk_level_ on
+        std::unique_ptr<DiskRun> disk;
+    };
+
+    static const size_t kCompactionRatio = 2;
+    static const size_t kMinCompaction = 64;
+    static const uint64_t kFileMagic = 0x726f6f50726f4650;  // "PForPoor"
+    static const size_t kFileAlignment = 64;
+    static const size_t kWriteBatch = 1 << 14;
+
+    bool incremental_;
+    std::string directory_;
+    size_t disk_level_ = kUnlimited;
+    std::vector<Level> levels_;
+    std::vector<Item> scratch_;
+    // Runs merged by finished jobs, destroyed a few items per update
+    std::vector<std::unique_ptr<Run>> retired_;
+    // Live keys and all items, with tombstones and shadowed pairs
+    size_t size_ = 0;
+    size_t stored_ = 0;
+
+    void add(Item item) {
+        if (incremental_)
+            add_incremental(std::move(item));
+        else
+            add_amortized(std::move(item));
     }
 
-    int size() const { return size_; }
+    void add_amortized(Item item) {
+        size_t target = 0, merged = 1;
+        while (target < levels_.size() && level_size(target) != 0)
+            merged += level_size(target++);
+        if (target == levels_.size()) {
+            levels_.emplace_back();
+            levels_.back().runs.push_back(std::make_unique<Run>());
+            if (target < disk_level_)
+                levels_.back().runs[0]->items.reserve(size_t(1) << target);
+        }
+        auto& result = levels_[target].runs[0]->items;
+        if (target >= disk_level_) {
+            add_to_disk(std::move(item), target);
+        } else if (target == 0) {
+            result.push_back(std::move(item));
+        } else {
+            bool oldest = empty_from(target + 1);
+            // Merges alternate between the target level and scratch_, so the last one
+            // writes into the target
+            auto output = [&result, this, target](size_t step) -> std::vector<Item>& {
+                return (target - 1 - step) % 2 == 0 ? result : scratch_;
+            };
+            for (size_t step = 0; step < target; ++step) {
+                auto& level = *levels_[step].runs[0];
+                auto drop_erased = oldest && step + 1 == target;
+                if (step == 0) {
+                    merge_items(&item, &item + 1, level.items, drop_erased, output(0));
+                } else {
+                    auto& input = output(step - 1);
+                    merge_items(input.data(), input.data() + input.size(), level.items,
+                                drop_erased, output(step));
+                    input.clear();
+                }
+                level.next = nullptr;
+            }
+        }
+        stored_ = stored_ - (merged - 1) + level_size(target);
+        if (directory_.empty() && stored_ > kCompactionRatio * size_ + kMinCompaction)
+            compact();
+        else if (!result.empty())
+            build(*levels_[target].runs[0], newest_run(target + 1));
+    }
 
-private:
-    std::list<std::vector<std::pair<A, B>>> sets;
-    size_t size_;
+    // The carry of the levels in memory takes in every level on disk below target, and
+    // the last merge leaves the file of target. The levels are changed only once that
+    // file is mapped, so a failed write leaves the map as it was.
+    void add_to_disk(Item item, size_t target) {
+        bool oldest = empty_from(target + 1);
+        std::vector<Item> carry{std::move(item)}, merged;
+        for (size_t step = 0; step < disk_level_; ++step) {
+            const Item* newer = carry.data();
+            const Item* older = levels_[step].runs[0]->items.data();
+            auto budget = kUnlimited;
+            merged.clear();
+            merge_items(newer, newer + carry.size(), older,
+                        older + levels_[step].runs[0]->items.size(),
+                        oldest && step + 1 == target, merged, budget);
+            carry.swap(merged);
+        }
+        const Item* newer = carry.data();
+        const Item* newer_end = newer + carry.size();
+        std::unique_ptr<DiskRun> run;
+        if (target == disk_level_)
+            run = write_run(newer, newer_end, newer_end, newer_end, false);
+        for (auto step = disk_level_; step < target; ++step) {
+            auto& older = *levels_[step].disk;
+            // The previous carry is dropped only once the new one is written
+            run = write_run(newer, newer_end, older.items, older.items + older.size,
+                            oldest && step + 1 == target);
+            newer = run ? run->items : nullptr;
+            newer_end = run ? run->items + run->size : nullptr;
+        }
+
+        for (size_t step = 0; step < target; ++step) {
+            auto& level = levels_[step];
+            level.runs[0]->items.clear();
+            level.runs[0]->next = nullptr;
+            level.disk.reset();
+        }
+        levels_[target].disk = std::move(run);
+    }
+
+    // Writes the merge of two runs as a new file and maps it, nullptr if it is empty.
+    // Files get unique names, so maps may share a directory.
+    std::unique_ptr<DiskRun> write_run(const Item* newer, const Item* newer_end,
+                                       const Item* older, const Item* older_end,
+                                       bool drop_erased) {
+        auto run = std::make_unique<DiskRun>();
+        auto path = directory_ + "/run-XXXXXX";
+        int descriptor = ::mkstemp(path.data());
+        if (descriptor < 0)
+            throw std::system_error(errno, std::generic_category(), "mkstemp " + path);
+        ::close(descriptor);
+        // From here on the file is removed with run if anything throws
+        run->path = path;
+
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        auto pad = [&out](uint64_t size) {
+            static const char kZeros[kFileAlignment] = {};
+            out.write(kZeros, align_up(size) - size);
+        };
+        FileHeader header{kFileMagic, sizeof(Item), 0, 0};
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        pad(sizeof(header));
+        // Sized for all input items, as the output size is known only at the end
+        std::vector<FilterBlock> filter(filter_blocks((newer_end - newer) + (older_end - older)));
+        std::vector<Item> batch;
+        batch.reserve(kWriteBatch);
+        while (newer != newer_end || older != older_end) {
+            batch.clear();
+            auto budget = kWriteBatch;
+            merge_items(newer, newer_end, older, older_end, drop_erased, batch, budget);
+            for (auto& item : batch)
+                add_to_filter(filter, hash_key(item.pair.first));
+            out.write(reinterpret_cast<const char*>(batch.data()), batch.size() * sizeof(Item));
+            header.items_count += batch.size();
+        }
+        pad(header.items_count * sizeof(Item));
+        header.blocks_count = filter.size();
+        out.write(reinterpret_cast<const char*>(filter.data()), filter.size() * sizeof(FilterBlock));
+        out.seekp(0);
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        if (!out.flush())
+            throw std::runtime_error("MapForPoor: cannot write " + path);
+        out.close();
+        if (header.items_count == 0)
+            return nullptr;
+
+        run->file = std::make_unique<MappedFile>(path);
+        auto data = run->file->Data();
+        auto filter_offset = align_up(sizeof(header)) + align_up(header.items_count * sizeof(Item));
+        run->items = reinterpret_cast<const Item*>(data + align_up(sizeof(header)));
+        run->size = header.items_count;
+        run->filter = reinterpret_cast<const FilterBlock*>(data + filter_offset);
+        run->blocks = header.blocks_count;
+        return run;
+    }
+
+    static uint64_t align_up(uint64_t size) {
+        return (size + kFileAlignment - 1) / kFileAlignment * kFileAlignment;
+    }
+
+    // Items of the single run of a level in the amortized mode
+    size_t level_size(size_t index) const {
+        auto& level = levels_[index];
+        return level.disk ? level.disk->size : level.runs[0]->items.size();
+    }
+
+    bool empty_from(size_t index) const {
+        for (; index < levels_.size(); ++index) {
+            if (level_size(index) != 0)
+                return false;
+        }
+        return true;
+    }
+
+    // Leaves one level of live pairs and frees the buffers above it
+    void compact() {
+        std::vector<Item> carry, merged;
+        for (size_t index = 0; index < levels_.size(); ++index) {
+            auto& items = levels_[index].runs[0]->items;
+            if (!items.empty()) {
+                merge_items(carry.data(), carry.data() + carry.size(), items,
+                            empty_from(index + 1), merged);
+                carry.swap(merged);
+            }
+        }
+        size_t target = 0;
+        while ((size_t(1) << target) < carry.size())
+            ++target;
+        levels_.clear();
+        levels_.resize(target + 1);
+        for (size_t index = 0; index <= target; ++index) {
+            levels_[index].runs.push_back(std::make_unique<Run>());
+            levels_[index].runs[0]->items.reserve(size_t(1) << index);
+        }
+        auto& run = levels_[target].runs[0];
+        run->items.assign(std::make_move_iterator(carry.begin()),
+                          std::make_move_iterator(carry.end()));
+        scratch_ = std::vector<Item>();
+        stored_ = run->items.size();
+        if (!run->items.empty())
+            build(*run, nullptr);
+    }
+
+    void add_incremental(Item item) {
+        auto run = std::make_unique<Run>();
+        run->items.push_back(std::move(item));
+        build_filter(*run);
+        if (levels_.empty())
+            levels_.emplace_back();
+        levels_[0].runs.push_back(std::move(run));
+
+        // A job publishes its run before the next level is served, so that level may
+        // start its own job in the same update
+        for (size_t index = 0; index < levels_.size(); ++index) {
+            if (!levels_[index].job && levels_[index].runs.size() >= 2)
+                start_job(index);
+            if (!levels_[index].job)
+                continue;
+            auto& job = *levels_[index].job;
+            auto budget = job.updates_left == 1 ? kUnlimited
+                    : (job.work + job.updates_left - 1) / job.updates_left;
+            job.work -= std::min(job.work, budget);
+            --job.updates_left;
+            advance(job, budget);
+            if (job.updates_left == 0) {
+                auto result = std::move(job.result);
+                levels_[index].job.reset();
+                auto& runs = levels_[index].runs;
+                retired_.push_back(std::move(runs[0]));
+                retired_.push_back(std::move(runs[1]));
+                runs.erase(runs.begin(), runs.begin() + 2);
+                if (index + 1 == levels_.size())
+                    levels_.emplace_back();
+                levels_[index + 1].runs.push_back(std::move(result));
+            }
+        }
+        // Level k retires 2^(k+1) items every 2^(k+1) updates, so two items per level
+        // keep up with all of them
+        release_retired(2 * levels_.size());
+    }
+
+    // Destroys up to budget items of the retired runs, the newest first
+    void release_retired(size_t budget) {
+        while (!retired_.empty()) {
+            auto& items = retired_.back()->items;
+            auto count = std::min(budget, items.size());
+            items.erase(items.end() - count, items.end());
+            budget -= count;
+            if (!items.empty())
+                return;
+            retired_.pop_back();
+        }
+    }
+
+    void start_job(size_t index) {
+        auto& level = levels_[index];
+        level.job = std::make_unique<Job>();
+        auto& job = *level.job;
+        job.older = level.runs[0].get();
+        job.newer = level.runs[1].get();
+        job.result = std::make_unique<Run>();
+        // Growing the vector would copy it all in one update
+        job.result->items.reserve(job.newer->items.size() + job.older->items.size());
+        job.newer_cursor = job.newer->items.data();
+        job.older_cursor = job.older->items.data();
+        job.drop_erased = true;
+        for (auto above = index + 1; above < levels_.size(); ++above)
+            job.drop_erased &= levels_[above].runs.empty();
+        job.work = 2 * (job.newer->items.size() + job.older->items.size());
+        job.updates_left = size_t(1) << index;
+    }
+
+    void advance(Job& job, size_t budget) const {
+        auto& run = *job.result;
+        auto newer_end = job.newer->items.data() + job.newer->items.size();
+        auto older_end = job.older->items.data() + job.older->items.size();
+        if (job.newer_cursor != newer_end || job.older_cursor != older_end) {
+            if (!merge_items(job.newer_cursor, newer_end, job.older_cursor, older_end,
+                             job.drop_erased, run.items, budget))
+                return;
+            start_filter(run);
+        }
+        extend_filter(run, job.hashed, budget);
+    }
+
+    // Newest non-empty run of the levels from index on
+    const Run* newest_run(size_t index) const {
+        for (; index < levels_.size(); ++index) {
+            auto& runs = levels_[index].runs;
+            for (auto run = runs.rbegin(); run != runs.rend(); ++run) {
+                if (!(*run)->items.empty())
+                    return run->get();
+            }
+        }
+        return nullptr;
+    }
+
+    // Calls function(run) for the non-empty runs from the newest on while it returns true
+    template<class Function>
+    void for_each_run(Function function) const {
+        for (auto& level : levels_) {
+            for (auto run = level.runs.rbegin(); run != level.runs.rend(); ++run) {
+                if (!(*run)->items.empty() && !function(**run))
+                    return;
+            }
+        }
+    }
+
+    // Calls function(first, last, filter, blocks) for the items and the filter of the
+    // non-empty runs from the newest on, including the levels on disk
+    template<class Function>
+    void for_each_items(Function function) const {
+        for_each_run([&function](const Run& run) {
+            function(run.items.data(), run.items.data() + run.items.size(),
+                     run.filter.data(), run.filter.size());
+            return true;
+        });
+        for (auto index = disk_level_; index < levels_.size(); ++index) {
+            if (auto& run = levels_[index].disk)
+                function(run->items, run->items + run->size, run->filter, run->blocks);
+        }
+    }
+
+    // Iterator at the first live pair not less than *from, or at the first one
+    const_iterator make_iterator(const A* from) const {
+        const_iterator iterator;
+        for_each_items([&](const Item* first, const Item* last, const FilterBlock*, size_t) {
+            if (from != nullptr)
+                first = item_lower_bound(first, last, *from);
+            if (first != last)
+                iterator.heap_.push_back({first, last, iterator.heap_.size()});
+        });
+        std::make_heap(iterator.heap_.begin(), iterator.heap_.end(), const_iterator::later);
+        iterator.skip_erased();
+        return iterator;
+    }
+
+    // Calls output(i, newest item of keys[i] or nullptr). Queries whose filter fails skip
+    // the run, and the rest move one cursor forward through it.
+    template<class Output>
+    void find_batch(const A* keys, size_t count, Output output) const {
+        std::vector<size_t> pending(count), unresolved;
+        std::iota(pending.begin(), pending.end(), size_t(0));
+        std::sort(pending.begin(), pending.end(),
+                  [keys](size_t lhs, size_t rhs) { return keys[lhs] < keys[rhs]; });
+        std::vector<uint64_t> hashes(count);
+        for (size_t index = 0; index < count; ++index)
+            hashes[index] = hash_key(keys[index]);
+        for_each_items([&](const Item* first, const Item* last, const FilterBlock* filter,
+                           size_t blocks) {
+            unresolved.clear();
+            for (auto index : pending) {
+                if (may_contain(filter, blocks, hashes[index])) {
+                    first = gallop(first, last, keys[index]);
+                    if (first != last && !(keys[index] < first->pair.first)) {
+                        output(index, first);
+                        continue;
+                    }
+                }
+                unresolved.push_back(index);
+            }
+            pending.swap(unresolved);
+        });
+        for (auto index : pending)
+            output(index, nullptr);
+    }
+
+    // First item of [first, last) not less than key, found by doubling the step from
+    // first, so a pass over sorted keys costs the logarithms of the gaps between them
+    static const Item* gallop(const Item* first, const Item* last, const A& key) {
+        size_t size = last - first, low = 0, high = 1;
+        while (high < size && first[high - 1].pair.first < key) {
+            low = high;
+            high *= 2;
+        }
+        return item_lower_bound(first + low, first + std::min(high, size), key);
+    }
+
+    static size_t cascade_lower_bound(const std::vector<Bridge>& cascade, size_t first,
+                                      size_t last, const A& key) {
+        return branchless_lower_bound(cascade.data() + first, cascade.data() + last,
+                [&key](const Bridge& bridge) { return bridge.key < key; }) - cascade.data();
+    }
+
+    // Newest item of key, which may be a tombstone
+    const Item* find(const A& key) const {
+        auto hash = hash_key(key);
+        const Run* last = nullptr;
+        size_t passed = 0;
+        for_each_run([&](const Run& run) {
+            if (may_contain(run, hash)) {
+                last = &run;
+                ++passed;
+            }
+            return true;
+        });
+        if (last == nullptr)
+            return find_on_disk(key, hash);
+        // Filters pass mostly for the one run which holds the key
+        if (passed == 1) {
+            auto end = last->items.data() + last->items.size();
+            auto item = item_lower_bound(last->items.data(), end, key);
+            return item != end && !(key < item->pair.first) ? item : find_on_disk(key, hash);
+        }
+        const Item* found = nullptr;
+        const Run* previous = nullptr;
+        size_t position = 0;
+        for_each_run([&](const Run& run) {
+            if (previous != nullptr && previous->next == &run) {
+                // Sampled keys before position are less than key, the one at down is not
+                auto down = position < previous->cascade.size()
+                        ? previous->cascade[position].down : previous->end_down;
+                position = cascade_lower_bound(run.cascade,
+                        down < previous->step ? 0 : down - previous->step + 1,
+                        std::min(down, run.cascade.size()), key);
+            } else if (!run.cascade.empty()) {
+                position = cascade_lower_bound(run.cascade, 0, run.cascade.size(), key);
+            }
+            previous = &run;
+            if (!may_contain(run, hash))
+                return true;
+            size_t own;
+            if (run.cascade.empty())
+                own = item_lower_bound(run, key);
+            else
+                own = position < run.cascade.size() ? run.cascade[position].own : run.items.size();
+            if (own < run.items.size() && !(key < run.items[own].pair.first))
+                found = &run.items[own];
+            return found == nullptr && &run != last;
+        });
+        return found != nullptr ? found : find_on_disk(key, hash);
+    }
+
+    const Item* find_on_disk(const A& key, uint64_t hash) const {
+        for (auto index = disk_level_; index < levels_.size(); ++index) {
+            auto& run = levels_[index].disk;
+            if (!run || !may_contain(run->filter, run->blocks, hash))
+                continue;
+            auto found = item_lower_bound(run->items, run->items + run->size, key);
+            if (found != run->items + run->size && !(key < found->pair.first))
+                return found;
+        }
+        return nullptr;
+    }
+
+    void build(Run& run, const Run* next) const {
+        if constexpr (!kFiltered) {
+            size_t own = 0, down = 0, budget = kUnlimited;
+            start_cascade(run, next);
+            extend_cascade(run, own, down, budget);
+        }
+        build_filter(run);
+    }
+
+    static void start_cascade(Run& run, const Run* next) {
+        run.next = next;
+        auto next_size = run.next ? run.next->cascade.size() : 0;
+        // Takes at most as many samples as items, so cascades stay within twice the items
+        run.step = std::max<size_t>(2, (next_size + run.items.size() - 1) / run.items.size());
+        run.cascade.clear();
+    }
+
+    // Adds bridges from the cursors on, a unit of budget each, returns true when done
+    static bool extend_cascade(Run& run, size_t& own, size_t& down, size_t& budget) {
+        static const std::vector<Bridge> kEmpty;
+        auto& next = run.next ? run.next->cascade : kEmpty;
+        for (; own < run.items.size() || down < next.size(); --budget) {
+            if (budget == 0)
+                return false;
+            if (down >= next.size() ||
+                    (own < run.items.size() && !(next[down].key < run.items[own].pair.first))) {
+                run.cascade.push_back({run.items[own].pair.first, own, down});
+                ++own;
+            } else {
+                run.cascade.push_back({next[down].key, own, down});
+                down += run.step;
+            }
+        }
+        run.end_down = down;
+        return true;
+    }
 };
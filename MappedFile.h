@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cerrno>
+#include <cstddef>
+#include <string>
+#include <system_error>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Read-only mapping of a whole file, pages are loaded on first access and shared
+// with every other process mapping the same file
+class MappedFile {
+public:
+    explicit MappedFile(const std::string& path)
+    {
+        int descriptor = ::open(path.c_str(), O_RDONLY);
+        if (descriptor < 0) {
+            throw std::system_error(errno, std::generic_category(), "open " + path);
+        }
+        struct stat status;
+        if (::fstat(descriptor, &status) != 0) {
+            auto error = errno;
+            ::close(descriptor);
+            throw std::system_error(error, std::generic_category(), "stat " + path);
+        }
+        size_ = status.st_size;
+        if (size_ != 0) {
+            data_ = ::mmap(nullptr, size_, PROT_READ, MAP_SHARED, descriptor, 0);
+        }
+        auto error = errno;
+        ::close(descriptor);
+        if (data_ == MAP_FAILED) {
+            data_ = nullptr;
+            throw std::system_error(error, std::generic_category(), "mmap " + path);
+        }
+    }
+
+    ~MappedFile()
+    {
+        if (data_ != nullptr) {
+            ::munmap(data_, size_);
+        }
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const char* Data() const { return static_cast<const char*>(data_); }
+    size_t Size() const { return size_; }
+
+private:
+    void* data_ = nullptr;
+    size_t size_ = 0;
+};
@@ -0,0 +1,333 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <random>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "MixBits.h"
+
+// Maps a uniform 64-bit value onto [0, size) without division
+inline uint64_t FastRange(uint64_t value, uint64_t size)
+{
+    return (static_cast<unsigned __int128>(value) * size) >> 64;
+}
+
+// Array of unsigned integers of a fixed bit width packed into 64-bit words
+class CompactVector {
+public:
+    CompactVector() = default;
+
+    CompactVector(size_t size, uint32_t width)
+            : width_(width)
+            , mask_(width == 64 ? ~0ull : (1ull << width) - 1)
+            , words_((size * width + 63) / 64 + 1, 0)
+    {
+    }
+
+    uint64_t Get(size_t index) const
+    {
+        auto bit = index * width_;
+        auto word = bit / 64, shift = bit % 64;
+        auto value = words_[word] >> shift;
+        if (shift + width_ > 64) {
+            value |= words_[word + 1] << (64 - shift);
+        }
+        return value & mask_;
+    }
+
+    void Set(size_t index, uint64_t value)
+    {
+        auto bit = index * width_;
+        auto word = bit / 64, shift = bit % 64;
+        words_[word] &= ~(mask_ << shift);
+        words_[word] |= value << shift;
+        if (shift + width_ > 64) {
+            words_[word + 1] &= ~(mask_ >> (64 - shift));
+            words_[word + 1] |= value >> (64 - shift);
+        }
+    }
+
+    size_t MemoryBits() const { return words_.size() * 64; }
+
+    static uint32_t WidthOf(uint64_t max_value)
+    {
+        uint32_t width = 1;
+        while (width < 64 && (max_value >> width) != 0) {
+            ++width;
+        }
+        return width;
+    }
+
+private:
+    uint32_t width_ = 1;
+    uint64_t mask_ = 1;
+    std::vector<uint64_t> words_;
+};
+
+// Minimal perfect hash in the PTHash scheme: keys are split into buckets of about
+// kBucketSize, and each bucket stores the smallest pilot which sends all its keys to
+// free positions of a table slightly larger than n. Positions past n are remapped onto
+// the holes below n. Takes about 3 bits per key. Keys outside the set get arbitrary
+// indices.
+template <typename Key = int, typename Hash = std::hash<Key>>
+class MinimalPerfectHash {
+public:
+    static constexpr uint64_t kDefaultSeed = 228;
+
+    // The result depends only on elements and seed, so builds are reproducible and
+    // different functions may be built concurrently. Equal keys get one index. Like
+    // FixedSet, throws std::invalid_argument if two distinct keys have equal Hash
+    // values, and then leaves the function unchanged.
+    void Initialize(const std::vector<Key>& elements, uint64_t seed = kDefaultSeed);
+
+    // Index of value in [0, Size()) if value is one of the keys
+    uint64_t operator()(const Key& value) const
+    {
+        auto hash = hash_(value);
+        auto position = Position(hash, PilotHash(Pilot(Bucket(hash))));
+        return position < size_ ? position : remap_.Get(position - size_);
+    }
+
+    uint64_t Size() const { return size_; }
+    size_t MemoryBits() const
+    {
+        return pilots_.MemoryBits() + remap_.MemoryBits() +
+               large_pilots_.size() * sizeof(large_pilots_[0]) * 8;
+    }
+
+private:
+    static constexpr double kBucketSize = 5;
+    static constexpr double kLoadFactor = 0.98;
+    static constexpr uint64_t kMaxPilot = 1 << 24;
+    // Skewed split as in PTHash: kDenseKeys of the keys go to kDenseBuckets of the
+    // buckets, which are large and so are placed first, while the table is empty
+    static constexpr double kDenseKeys = 0.6;
+    static constexpr double kDenseBuckets = 0.3;
+    // Share of the buckets allowed to have pilots which do not fit in pilots_
+    static constexpr uint64_t kLargePilotsRatio = 1024;
+
+    Hash hash_;
+    uint64_t seed_ = 0;
+    uint64_t size_ = 0;
+    uint64_t table_size_ = 0;
+    uint64_t buckets_count_ = 0;
+    uint64_t dense_buckets_count_ = 0;
+    // Most pilots are small, so pilots_ is narrow and the rare large ones are stored
+    // as (bucket, pilot) in large_pilots_, marked by the largest value in pilots_
+    CompactVector pilots_;
+    uint64_t large_pilot_mark_ = 0;
+    std::vector<std::pair<uint64_t, uint64_t>> large_pilots_;
+    CompactVector remap_;
+
+    uint64_t Bucket(uint64_t hash) const
+    {
+        auto mixed = MixBits(hash ^ seed_);
+        if ((mixed & 0xffffffff) < static_cast<uint64_t>(kDenseKeys * (1ull << 32))) {
+            return FastRange(mixed, dense_buckets_count_);
+        }
+        return dense_buckets_count_ + FastRange(mixed, buckets_count_ - dense_buckets_count_);
+    }
+
+    uint64_t Pilot(uint64_t bucket) const
+    {
+        auto pilot = pilots_.Get(bucket);
+        if (pilot != large_pilot_mark_) {
+            return pilot;
+        }
+        return std::lower_bound(large_pilots_.begin(), large_pilots_.end(),
+                                std::make_pair(bucket, static_cast<uint64_t>(0)))
+                ->second;
+    }
+
+    uint64_t PilotHash(uint64_t pilot) const { return MixBits(pilot + seed_); }
+
+    uint64_t Position(uint64_t hash, uint64_t pilot_hash) const
+    {
+        return FastRange(MixBits(hash ^ pilot_hash), table_size_);
+    }
+
+    bool TryBuild(const std::vector<uint64_t>& hashes);
+};
+
+template <typename Key, typename Hash>
+void MinimalPerfectHash<Key, Hash>::Initialize(const std::vector<Key>& elements, uint64_t seed)
+{
+    std::vector<std::pair<uint64_t, size_t>> hashed(elements.size());
+    for (size_t i = 0; i < elements.size(); ++i) {
+        hashed[i] = { hash_(elements[i]), i };
+    }
+    std::sort(hashed.begin(), hashed.end());
+    hashed.erase(std::unique(hashed.begin(), hashed.end(),
+                             [&elements](const auto& left, const auto& right) {
+                                 return left.first == right.first &&
+                                        elements[left.second] == elements[right.second];
+                             }),
+                 hashed.end());
+    // Equal hashes left after the duplicate keys are gone belong to distinct keys
+    if (std::adjacent_find(hashed.begin(), hashed.end(), [](const auto& left, const auto& right) {
+            return left.first == right.first;
+        }) != hashed.end()) {
+        throw std::invalid_argument("MinimalPerfectHash: distinct keys have equal hashes");
+    }
+    std::vector<uint64_t> hashes(hashed.size());
+    for (size_t i = 0; i < hashed.size(); ++i) {
+        hashes[i] = hashed[i].first;
+    }
+
+    std::mt19937_64 generator(seed);
+    do {
+        seed_ = generator();
+    } while (!TryBuild(hashes));
+}
+
+// Returns false if some bucket found no pilot below kMaxPilot, then a new seed is needed
+template <typename Key, typename Hash>
+bool MinimalPerfectHash<Key, Hash>::TryBuild(const std::vector<uint64_t>& hashes)
+{
+    size_ = hashes.size();
+    table_size_ = std::max<uint64_t>(size_ / kLoadFactor, size_ + 1);
+    buckets_count_ = std::max<uint64_t>(size_ / kBucketSize, 2);
+    dense_buckets_count_ = std::max<uint64_t>(buckets_count_ * kDenseBuckets, 1);
+
+    // Counting sort of the hashes by bucket
+    std::vector<uint64_t> begins(buckets_count_ + 1, 0);
+    for (auto hash : hashes) {
+        ++begins[Bucket(hash) + 1];
+    }
+    uint64_t max_bucket_size = 0;
+    for (uint64_t i = 0; i < buckets_count_; ++i) {
+        max_bucket_size = std::max(max_bucket_size, begins[i + 1]);
+        begins[i + 1] += begins[i];
+    }
+    std::vector<uint64_t> bucket_hashes(size_);
+    {
+        std::vector<uint64_t> positions(begins.begin(), begins.end() - 1);
+        for (auto hash : hashes) {
+            bucket_hashes[positions[Bucket(hash)]++] = hash;
+        }
+    }
+
+    // Largest buckets go first, while the table is still empty
+    std::vector<uint64_t> order(buckets_count_);
+    {
+        std::vector<uint64_t> by_size(max_bucket_size + 2, 0);
+        for (uint64_t i = 0; i < buckets_count_; ++i) {
+            ++by_size[max_bucket_size - (begins[i + 1] - begins[i]) + 1];
+        }
+        for (uint64_t i = 0; i <= max_bucket_size; ++i) {
+            by_size[i + 1] += by_size[i];
+        }
+        for (uint64_t i = 0; i < buckets_count_; ++i) {
+            order[by_size[max_bucket_size - (begins[i + 1] - begins[i])]++] = i;
+        }
+    }
+
+    std::vector<uint64_t> pilots(buckets_count_, 0);
+    std::vector<bool> taken(table_size_, false);
+    std::vector<uint64_t> positions;
+    for (auto bucket : order) {
+        auto first = bucket_hashes.begin() + begins[bucket];
+        auto last = bucket_hashes.begin() + begins[bucket + 1];
+        if (first == last) {
+            continue;
+        }
+        for (uint64_t pilot = 0;; ++pilot) {
+            if (pilot == kMaxPilot) {
+                return false;
+            }
+            positions.clear();
+            auto pilot_hash = PilotHash(pilot);
+            for (auto iter = first; iter != last; ++iter) {
+                auto position = Position(*iter, pilot_hash);
+                if (taken[position] ||
+                    std::find(positions.begin(), positions.end(), position) != positions.end()) {
+                    break;
+                }
+                positions.push_back(position);
+            }
+            if (positions.size() == static_cast<size_t>(last - first)) {
+                for (auto position : positions) {
+                    taken[position] = true;
+                }
+                pilots[bucket] = pilot;
+                break;
+            }
+        }
+    }
+
+    std::vector<uint64_t> widths_count(65, 0);
+    for (auto pilot : pilots) {
+        ++widths_count[CompactVector::WidthOf(pilot + 1)];
+    }
+    uint32_t width = 64;
+    for (uint64_t large_count = 0; width > 1; --width) {
+        large_count += widths_count[width];
+        if (large_count > buckets_count_ / kLargePilotsRatio) {
+            break;
+        }
+    }
+    pilots_ = CompactVector(buckets_count_, width);
+    large_pilot_mark_ = (width == 64 ? ~0ull : (1ull << width) - 1);
+    large_pilots_.clear();
+    for (uint64_t i = 0; i < buckets_count_; ++i) {
+        if (pilots[i] < large_pilot_mark_) {
+            pilots_.Set(i, pilots[i]);
+        } else {
+            pilots_.Set(i, large_pilot_mark_);
+            large_pilots_.emplace_back(i, pilots[i]);
+        }
+    }
+
+    // Taken positions past n go to the free ones below n in increasing order
+    remap_ = CompactVector(table_size_ - size_, CompactVector::WidthOf(size_));
+    uint64_t hole = 0;
+    for (uint64_t position = size_; position < table_size_; ++position) {
+        if (taken[position]) {
+            while (taken[hole]) {
+                ++hole;
+            }
+            remap_.Set(position - size_, hole++);
+        }
+    }
+    return true;
+}
+
+// Set which stores nothing but the keys, ordered by their minimal perfect hash.
+// Index lets callers keep associated values in their own array.
+template <typename Key = int, typename Hash = std::hash<Key>>
+class MinimalFixedSet {
+public:
+    // Throws as MinimalPerfectHash::Initialize does, and then leaves the set unchanged
+    void Initialize(const std::vector<Key>& elements,
+                    uint64_t seed = MinimalPerfectHash<Key, Hash>::kDefaultSeed)
+    {
+        hash_function_.Initialize(elements, seed);
+        keys_.resize(hash_function_.Size());
+        for (const auto& element : elements) {
+            keys_[hash_function_(element)] = element;
+        }
+    }
+
+    bool Contains(const Key& value) const { return Index(value) != keys_.size(); }
+
+    // Position of value in [0, size) if it is in the set, and size otherwise
+    size_t Index(const Key& value) const
+    {
+        if (keys_.empty()) {
+            return 0;
+        }
+        auto index = hash_function_(value);
+        return keys_[index] == value ? index : keys_.size();
+    }
+
+    const Key& operator[](size_t index) const { return keys_[index]; }
+    size_t Size() const { return keys_.size(); }
+
+private:
+    MinimalPerfectHash<Key, Hash> hash_function_;
+    std::vector<Key> keys_;
+};
@@ -0,0 +1,11 @@
+#pragma once
+
+#include <cstdint>
+
+// Bijection of 64-bit words with good avalanche (splitmix64 finalizer)
+inline uint64_t MixBits(uint64_t value)
+{
+    value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9ull;
+    value = (value ^ (value >> 27)) * 0x94d049bb133111ebull;
+    return value ^ (value >> 31);
+}
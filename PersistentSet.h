@@ -0,0 +1,410 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <initializer_list>
+#include <iterator>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Immutable AVL node shared between versions. Functions below take borrowed pointers
+// and return owned ones, except Create and Balance which also take ownership of children.
+template <typename ValueType>
+struct NodePersistent {
+    const NodePersistent* left;
+    const NodePersistent* right;
+    int height;
+    size_t size;
+    mutable std::atomic<uint32_t> references;
+    const ValueType value;
+
+    NodePersistent(const NodePersistent* left, const ValueType& value, const NodePersistent* right)
+        : left(left)
+        , right(right)
+        , height(std::max(GetHeight(left), GetHeight(right)) + 1)
+        , size(GetSize(left) + GetSize(right) + 1)
+        , references(1)
+        , value(value)
+    {
+    }
+
+    static int GetHeight(const NodePersistent<ValueType>* vertex)
+    {
+        return vertex == nullptr ? 0 : vertex->height;
+    }
+
+    static size_t GetSize(const NodePersistent<ValueType>* vertex)
+    {
+        return vertex == nullptr ? 0 : vertex->size;
+    }
+
+    static const NodePersistent<ValueType>* Retain(const NodePersistent<ValueType>* vertex)
+    {
+        if (vertex) {
+            vertex->references.fetch_add(1, std::memory_order_relaxed);
+        }
+        return vertex;
+    }
+
+    // Frees the nodes which are no longer referenced by any version
+    static void Release(const NodePersistent<ValueType>* vertex)
+    {
+        if (vertex && vertex->references.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            Release(vertex->left);
+            Release(vertex->right);
+            delete vertex;
+        }
+    }
+
+    static const NodePersistent<ValueType>* Create(const NodePersistent<ValueType>* left,
+                                                   const ValueType& value,
+                                                   const NodePersistent<ValueType>* right)
+    {
+        return new NodePersistent<ValueType>(left, value, right);
+    }
+
+    static const NodePersistent<ValueType>* Balance(const NodePersistent<ValueType>* left,
+                                                    const ValueType& value,
+                                                    const NodePersistent<ValueType>* right)
+    {
+        if (GetHeight(left) > GetHeight(right) + 1) {
+            const NodePersistent<ValueType>* result;
+            if (GetHeight(left->left) >= GetHeight(left->right)) {
+                result = Create(Retain(left->left), left->value,
+                                Create(Retain(left->right), value, right));
+            } else {
+                auto middle = left->right;
+                result = Create(Create(Retain(left->left), left->value, Retain(middle->left)),
+                                middle->value, Create(Retain(middle->right), value, right));
+            }
+            Release(left);
+            return result;
+        }
+        if (GetHeight(right) > GetHeight(left) + 1) {
+            const NodePersistent<ValueType>* result;
+            if (GetHeight(right->right) >= GetHeight(right->left)) {
+                result = Create(Create(left, value, Retain(right->left)), right->value,
+                                Retain(right->right));
+            } else {
+                auto middle = right->left;
+                result = Create(Create(left, value, Retain(middle->left)), middle->value,
+                                Create(Retain(middle->right), right->value, Retain(right->right)));
+            }
+            Release(right);
+            return result;
+        }
+        return Create(left, value, right);
+    }
+
+    // Returns the new version sharing all untouched subtrees, or the same root
+    // (retained) if value is already there
+    static const NodePersistent<ValueType>* Insert(const NodePersistent<ValueType>* vertex,
+                                                   const ValueType& value)
+    {
+        if (vertex == nullptr) {
+            return Create(nullptr, value, nullptr);
+        }
+        if (value < vertex->value) {
+            auto left = Insert(vertex->left, value);
+            if (left == vertex->left) {
+                Release(left);
+                return Retain(vertex);
+            }
+            return Balance(left, vertex->value, Retain(vertex->right));
+        } else if (vertex->value < value) {
+            auto right = Insert(vertex->right, value);
+            if (right == vertex->right) {
+                Release(right);
+                return Retain(vertex);
+            }
+            return Balance(Retain(vertex->left), vertex->value, right);
+        }
+        return Retain(vertex);
+    }
+
+    // Returns the rest of the tree and points minimum to the smallest value
+    static const NodePersistent<ValueType>* EraseMin(const NodePersistent<ValueType>* vertex,
+                                                     const ValueType*& minimum)
+    {
+        if (vertex->left == nullptr) {
+            minimum = &vertex->value;
+            return Retain(vertex->right);
+        }
+        auto left = EraseMin(vertex->left, minimum);
+        return Balance(left, vertex->value, Retain(vertex->right));
+    }
+
+    // Returns the new version, or the same root (retained) if value is not there
+    static const NodePersistent<ValueType>* Erase(const NodePersistent<ValueType>* vertex,
+                                                  const ValueType& value)
+    {
+        if (vertex == nullptr) {
+            return nullptr;
+        }
+        if (value < vertex->value) {
+            auto left = Erase(vertex->left, value);
+            if (left == vertex->left) {
+                Release(left);
+                return Retain(vertex);
+            }
+            return Balance(left, vertex->value, Retain(vertex->right));
+        } else if (vertex->value < value) {
+            auto right = Erase(vertex->right, value);
+            if (right == vertex->right) {
+                Release(right);
+                return Retain(vertex);
+            }
+            return Balance(Retain(vertex->left), vertex->value, right);
+        }
+
+        if (vertex->left == nullptr) {
+            return Retain(vertex->right);
+        }
+        if (vertex->right == nullptr) {
+            return Retain(vertex->left);
+        }
+        const ValueType* minimum;
+        auto right = EraseMin(vertex->right, minimum);
+        return Balance(Retain(vertex->left), *minimum, right);
+    }
+};
+
+template <typename ValueType>
+class ConcurrentSet;
+
+// Ordered set with the interface of Set where every version is immutable.
+// Copies and snapshots are O(1), insert and erase copy O(log n) nodes.
+// A version may be read from any number of threads; nodes are freed when
+// the last version using them is destroyed.
+template <typename ValueType>
+class PersistentSet {
+public:
+    using key_type = ValueType;
+    using value_type = ValueType;
+    using size_type = size_t;
+    using node_type = NodePersistent<value_type>;
+
+    // Keeps the path from the root, since nodes are shared and have no parents
+    class iterator {
+    private:
+        std::vector<const node_type*> path;
+        const PersistentSet<ValueType>* set;
+
+        void descend_left(const node_type* vertex)
+        {
+            while (vertex != nullptr) {
+                path.push_back(vertex);
+                vertex = vertex->left;
+            }
+        }
+
+        void descend_right(const node_type* vertex)
+        {
+            while (vertex != nullptr) {
+                path.push_back(vertex);
+                vertex = vertex->right;
+            }
+        }
+
+    public:
+        using iterator_category = std::bidirectional_iterator_tag;
+        using value_type = ValueType;
+        using reference = std::add_lvalue_reference_t<std::add_const_t<value_type>>;
+        using pointer = std::add_pointer_t<std::add_const_t<value_type>>;
+        using difference_type = int64_t;
+
+        iterator(std::vector<const node_type*> path, const PersistentSet<ValueType>* set)
+            : path(std::move(path))
+            , set(set)
+        {
+        }
+        iterator()
+            : set(nullptr)
+        {
+        }
+
+        inline iterator& operator++()
+        {
+            if (path.back()->right != nullptr) {
+                descend_left(path.back()->right);
+                return *this;
+            }
+            const node_type* child;
+            do {
+                child = path.back();
+                path.pop_back();
+            } while (!path.empty() && path.back()->right == child);
+            return *this;
+        }
+
+        inline iterator& operator--()
+        {
+            if (path.empty()) {
+                descend_right(set->root_);
+                return *this;
+            }
+            if (path.back()->left != nullptr) {
+                descend_right(path.back()->left);
+                return *this;
+            }
+            const node_type* child;
+            do {
+                child = path.back();
+                path.pop_back();
+            } while (!path.empty() && path.back()->left == child);
+            return *this;
+        }
+
+        iterator operator++(int)
+        {
+            iterator old = *this;
+            ++(*this);
+            return old;
+        }
+        iterator operator--(int)
+        {
+            iterator old = *this;
+            --(*this);
+            return old;
+        }
+
+        reference operator*() const { return path.back()->value; }
+        pointer operator->() const { return &path.back()->value; }
+
+        bool operator==(const iterator& other) const { return current() == other.current(); }
+        bool operator!=(const iterator& other) const { return current() != other.current(); }
+
+    private:
+        const node_type* current() const { return path.empty() ? nullptr : path.back(); }
+
+        friend class PersistentSet<ValueType>;
+    };
+
+    PersistentSet() = default;
+
+    template <typename InputIt>
+    PersistentSet(InputIt first, InputIt last)
+    {
+        while (first != last) {
+            insert(*first++);
+        }
+    }
+
+    explicit PersistentSet(std::initializer_list<ValueType> list)
+        : PersistentSet(list.begin(), list.end())
+    {
+    }
+
+    PersistentSet(const PersistentSet<ValueType>& other) // O(1)
+        : root_(node_type::Retain(other.root_))
+    {
+    }
+
+    PersistentSet(PersistentSet<ValueType>&& other) noexcept
+        : root_(other.root_)
+    {
+        other.root_ = nullptr;
+    }
+
+    ~PersistentSet()
+    {
+        node_type::Release(root_);
+    }
+
+    PersistentSet<ValueType>& operator=(PersistentSet<ValueType> other) // O(1)
+    {
+        std::swap(root_, other.root_);
+        return *this;
+    }
+
+    // Immutable point-in-time view, later updates of this set do not affect it.
+    // Must be taken by the thread owning this set; the view may be passed to any thread.
+    PersistentSet<ValueType> snapshot() const { return *this; }
+
+    iterator begin() const
+    {
+        iterator result({}, this);
+        result.descend_left(root_);
+        return result;
+    }
+    iterator end() const { return { {}, this }; }
+
+    void insert(const ValueType& value)
+    {
+        auto new_root = node_type::Insert(root_, value);
+        node_type::Release(root_);
+        root_ = new_root;
+    }
+
+    void erase(iterator iter)
+    {
+        if (iter == end()) {
+            return;
+        } else {
+            erase(*iter);
+        }
+    }
+
+    void erase(const ValueType& value)
+    {
+        auto new_root = node_type::Erase(root_, value);
+        node_type::Release(root_);
+        root_ = new_root;
+    }
+
+    iterator find(const ValueType& value) const
+    {
+        iterator result = lower_bound(value);
+        if (result == end() || value < *result) {
+            return end();
+        }
+        return result;
+    }
+    iterator lower_bound(const ValueType& value) const
+    {
+        return search(value, [](const ValueType& value, const ValueType& current) {
+            return !(current < value);
+        });
+    }
+    iterator upper_bound(const ValueType& value) const
+    {
+        return search(value, [](const ValueType& value, const ValueType& current) {
+            return value < current;
+        });
+    }
+
+    size_t size() const { return node_type::GetSize(root_); }
+    bool empty() const { return root_ == nullptr; }
+
+private:
+    const node_type* root_ = nullptr;
+
+    // Takes ownership of root
+    explicit PersistentSet(const node_type* root)
+        : root_(root)
+    {
+    }
+
+    friend class ConcurrentSet<ValueType>;
+
+    // Path to the first value for which fits(value, current) holds
+    template <typename Predicate>
+    iterator search(const ValueType& value, Predicate fits) const
+    {
+        std::vector<const node_type*> path;
+        size_t found_depth = 0;
+        for (auto vertex = root_; vertex != nullptr;) {
+            path.push_back(vertex);
+            if (fits(value, vertex->value)) {
+                found_depth = path.size();
+                vertex = vertex->left;
+            } else {
+                vertex = vertex->right;
+            }
+        }
+        path.resize(found_depth);
+        return { std::move(path), this };
+    }
+};
@@ -3,22 +3,44 @@
 #include <algorithm>
 #include <cassert>
 #include <initializer_list>
+#include <tuple>
 #include <utility>
 #include <iterator>
 
+#include "ThreadPool.h"
+
+// Nodes are threaded: prev and next link them in sorted order, so iteration
+// never walks the tree and no parent pointers are needed
 template <typename ValueType>
 struct NodeAvl {
-    NodeAvl* parent = nullptr;
     NodeAvl* left = nullptr;
     NodeAvl* right = nullptr;
+    NodeAvl* prev = nullptr;
+    NodeAvl* next = nullptr;
     int height = 1;
+    size_t size = 1;
     const ValueType value;
-    NodeAvl(const ValueType& value, NodeAvl* parent = nullptr)
-        : parent(parent)
+    NodeAvl(const ValueType& value, NodeAvl* prev = nullptr, NodeAvl* next = nullptr)
+        : prev(prev)
+        , next(next)
         , value(value)
     {
+        if (prev) {
+            prev->next = this;
+        }
+        if (next) {
+            next->prev = this;
+        }
     }
 
+    // Root of a tree together with its smallest and largest nodes. Links between
+    // nodes of the tree are consistent, links leading out of it may be stale.
+    struct Tree {
+        NodeAvl* root = nullptr;
+        NodeAvl* first = nullptr;
+        NodeAvl* last = nullptr;
+    };
+
     static void Clear(NodeAvl<ValueType>* vertex)
     {
         if (vertex == nullptr) {
@@ -72,15 +94,21 @@ struct NodeAvl {
         }
         return current_upper_bound;
     }
-     
+
     static int GetHeight(NodeAvl<ValueType>* vertex)
     {
         return vertex == nullptr ? 0 : vertex->height;
     }
 
+    static size_t GetSize(NodeAvl<ValueType>* vertex)
+    {
+        return vertex == nullptr ? 0 : vertex->size;
+    }
+
     static void Update(NodeAvl<ValueType>* vertex)
     {
         vertex->height = std::max(GetHeight(vertex->left), GetHeight(vertex->right)) + 1;
+        vertex->size = GetSize(vertex->left) + GetSize(vertex->right) + 1;
     }
 
     static NodeAvl<ValueType>* LLRotate(NodeAvl<ValueType>* vertex)
@@ -90,21 +118,10 @@ struct NodeAvl {
         auto c = vertex->right;
         auto root = vertex->left;
 
-        root->parent = vertex->parent;
-
         root->left = a;
-        a->parent = root;
         root->right = vertex;
-        root->right->parent = root;
-
         root->right->left = b;
-        if (b) {
-            b->parent = root->right;
-        }
         root->right->right = c;
-        if (c) {
-            c->parent = root->right;
-        }
 
         Update(root->left);
         Update(root->right);
@@ -120,21 +137,10 @@ struct NodeAvl {
         auto c = vertex->left;
         auto root = vertex->right;
 
-        root->parent = vertex->parent;
-
         root->right = a;
-        a->parent = root;
         root->left = vertex;
-        root->left->parent = root;
-
         root->left->right = b;
-        if (b) {
-            b->parent = root->left;
-        }
         root->left->left = c;
-        if (c) {
-            c->parent = root->left;
-        }
 
         Update(root->left);
         Update(root->right);
@@ -151,29 +157,12 @@ struct NodeAvl {
         auto d = vertex->right;
         auto root = vertex->left->right;
 
-        root->parent = vertex->parent;
-
         root->left = vertex->left;
-        root->left->parent = root;
         root->right = vertex;
-        root->right->parent = root;
-
         root->left->left = a;
-        if (a) {
-            a->parent = root->left;
-        }
         root->left->right = b;
-        if (b) {
-            b->parent = root->left;
-        }
         root->right->left = c;
-        if (c) {
-            c->parent = root->right;
-        }
         root->right->right = d;
-        if (d) {
-            d->parent = root->right;
-        }
 
         Update(root->left);
         Update(root->right);
@@ -189,29 +178,12 @@ struct NodeAvl {
         auto d = vertex->left;
         auto root = vertex->right->left;
 
-        root->parent = vertex->parent;
-
         root->right = vertex->right;
-        root->right->parent = root;
         root->left = vertex;
-        root->left->parent = root;
-
         root->right->right = a;
-        if (a) {
-            a->parent = root->right;
-        }
         root->right->left = b;
-        if (b) {
-            b->parent = root->right;
-        }
         root->left->right = c;
-        if (c) {
-            c->parent = root->left;
-        }
         root->left->left = d;
-        if (d) {
-            d->parent = root->left;
-        }
 
         Update(root->left);
         Update(root->right);
@@ -250,7 +222,7 @@ struct NodeAvl {
             return vertex;
         } else if (value < vertex->value) {
             if (vertex->left == nullptr) {
-                vertex->left = new NodeAvl<ValueType>(value, vertex);
+                vertex->left = new NodeAvl<ValueType>(value, vertex->prev, vertex);
             } else {
                 vertex->left = Insert(vertex->left, value);
                 Update(vertex->left);
@@ -258,7 +230,7 @@ struct NodeAvl {
             return vertex = Balance(vertex);
         } else {
             if (vertex->right == nullptr) {
-                vertex->right = new NodeAvl<ValueType>(value, vertex);
+                vertex->right = new NodeAvl<ValueType>(value, vertex, vertex->next);
             } else {
                 vertex->right = Insert(vertex->right, value);
                 Update(vertex->right);
@@ -267,94 +239,274 @@ struct NodeAvl {
         }
     }
 
-    static NodeAvl<ValueType>* FindMin(NodeAvl<ValueType>* vertex)
+    static NodeAvl<ValueType>* Erase(NodeAvl<ValueType>* vertex, const ValueType& value)
     {
-        vertex = vertex->right;
-        while (vertex->left) {
-            vertex = vertex->left;
+        if (vertex == nullptr) {
+            return nullptr;
         }
-        return vertex;
+
+        if (value < vertex->value) {
+            vertex->left = Erase(vertex->left, value);
+            return vertex = Balance(vertex);
+        } else if (vertex->value < value) {
+            vertex->right = Erase(vertex->right, value);
+            return vertex = Balance(vertex);
+        }
+
+        if (vertex->prev) {
+            vertex->prev->next = vertex->next;
+        }
+        if (vertex->next) {
+            vertex->next->prev = vertex->prev;
+        }
+
+        NodeAvl<ValueType>* replacement;
+        if (vertex->left == nullptr || vertex->right == nullptr) {
+            replacement = vertex->left != nullptr ? vertex->left : vertex->right;
+        } else {
+            auto rest = SplitFirst(vertex->right, replacement);
+            replacement->left = vertex->left;
+            replacement->right = rest;
+            replacement = Balance(replacement);
+        }
+        delete vertex;
+        return replacement;
     }
 
-    static NodeAvl<ValueType>* Erase(NodeAvl<ValueType>* vertex, const ValueType& value)
+    // Makes middle the root over left and right, their heights must differ by at most one
+    static NodeAvl<ValueType>* Link(NodeAvl<ValueType>* left, NodeAvl<ValueType>* middle,
+                                    NodeAvl<ValueType>* right)
     {
-        if (vertex == nullptr) {
-            return nullptr;
+        middle->left = left;
+        middle->right = right;
+        Update(middle);
+        return middle;
+    }
+
+    static NodeAvl<ValueType>* JoinRight(NodeAvl<ValueType>* left, NodeAvl<ValueType>* middle,
+                                         NodeAvl<ValueType>* right)
+    {
+        if (GetHeight(left) <= GetHeight(right) + 1) {
+            return Link(left, middle, right);
         }
+        left->right = JoinRight(left->right, middle, right);
+        return Balance(left);
+    }
 
-        if (vertex->value == value) {
-            if (vertex->left == nullptr && vertex->right == nullptr) {
-                delete vertex;
-                return nullptr;
-            } else if (vertex->left == nullptr) {
-                vertex->right->parent = vertex->parent;
-                auto cuted = vertex->right;
-                delete vertex;
-                return cuted = Balance(cuted);
-            } else if (vertex->right == nullptr) {
-                vertex->left->parent = vertex->parent;
-                auto cuted = vertex->left;
-                delete vertex;
-                return cuted = Balance(cuted);
-            } else {
-                auto replacement = FindMin(vertex);
+    static NodeAvl<ValueType>* JoinLeft(NodeAvl<ValueType>* left, NodeAvl<ValueType>* middle,
+                                        NodeAvl<ValueType>* right)
+    {
+        if (GetHeight(right) <= GetHeight(left) + 1) {
+            return Link(left, middle, right);
+        }
+        right->left = JoinLeft(left, middle, right->left);
+        return Balance(right);
+    }
 
-                if (replacement->parent->left == replacement) {
-                    replacement->parent->left = replacement->right; // null or size = 1
-                    if (replacement->right)
-                        replacement->right->parent = replacement->parent;
-                } else {
-                    replacement->parent->right = replacement->right; // null or size = 1
-                    if (replacement->right)
-                        replacement->right->parent = replacement->parent;
-                }
+    // Values of left < middle->value < values of right, O(|height(left) - height(right)| + 1).
+    // Keeps the links as they are, which is right when the parts were adjacent before.
+    static NodeAvl<ValueType>* Join(NodeAvl<ValueType>* left, NodeAvl<ValueType>* middle,
+                                    NodeAvl<ValueType>* right)
+    {
+        if (GetHeight(left) > GetHeight(right) + 1) {
+            return JoinRight(left, middle, right);
+        } else if (GetHeight(right) > GetHeight(left) + 1) {
+            return JoinLeft(left, middle, right);
+        }
+        return Link(left, middle, right);
+    }
 
-                auto go_up = replacement->parent; // balance way from vertex to repl
-                while (go_up != nullptr && go_up != vertex) {
-                    if (go_up->parent->left == go_up) {
-                        go_up = Balance(go_up);
-                        assert(go_up != nullptr);
-                        go_up->parent->left = go_up;
-                    } else {
-                        go_up = Balance(go_up);
-                        assert(go_up != nullptr);
-                        go_up->parent->right = go_up;
-                    }
-                    go_up = go_up->parent;
-                }
+    // Joins the trees and links middle between the largest node of left
+    // and the smallest node of right
+    static Tree Join(const Tree& left, NodeAvl<ValueType>* middle, const Tree& right)
+    {
+        middle->prev = left.last;
+        if (left.last) {
+            left.last->next = middle;
+        }
+        middle->next = right.first;
+        if (right.first) {
+            right.first->prev = middle;
+        }
+        return { Join(left.root, middle, right.root), left.root ? left.first : middle,
+                 right.root ? right.last : middle };
+    }
 
-                replacement->parent = vertex->parent;
+    // Detaches the minimum of the tree into first and returns the rest
+    static NodeAvl<ValueType>* SplitFirst(NodeAvl<ValueType>* vertex, NodeAvl<ValueType>*& first)
+    {
+        if (vertex->left == nullptr) {
+            first = vertex;
+            auto rest = vertex->right;
+            vertex->right = nullptr;
+            Update(vertex);
+            return rest;
+        }
+        vertex->left = SplitFirst(vertex->left, first);
+        return Balance(vertex);
+    }
 
-                replacement->left = vertex->left;
-                if (replacement->left) {
-                    replacement->left->parent = replacement;
-                }
-                replacement->right = vertex->right;
-                if (replacement->right) {
-                    replacement->right->parent = replacement;
-                }
+    // Values of left < values of right, O(log n)
+    static Tree Join2(const Tree& left, const Tree& right)
+    {
+        if (left.root == nullptr) {
+            return right;
+        }
+        if (right.root == nullptr) {
+            return left;
+        }
+        NodeAvl<ValueType>* first;
+        auto rest_root = SplitFirst(right.root, first);
+        Tree rest;
+        if (rest_root != nullptr) {
+            rest = { rest_root, first->next, right.last };
+        }
+        return Join(left, first, rest);
+    }
 
-                replacement = Balance(replacement);
+    // Returns the trees of values less than value, the node equal to value (or nullptr)
+    // and the tree of values greater than value, O(log n)
+    static std::tuple<NodeAvl<ValueType>*, NodeAvl<ValueType>*, NodeAvl<ValueType>*>
+    Split(NodeAvl<ValueType>* root, const ValueType& value)
+    {
+        if (root == nullptr) {
+            return { nullptr, nullptr, nullptr };
+        }
+        auto left = root->left;
+        auto right = root->right;
+        if (value < root->value) {
+            auto [less, equal, greater] = Split(left, value);
+            return { less, equal, Join(greater, root, right) };
+        } else if (root->value < value) {
+            auto [less, equal, greater] = Split(right, value);
+            return { Join(left, root, less), equal, greater };
+        }
+        root->left = root->right = nullptr;
+        Update(root);
+        return { left, root, right };
+    }
 
-                delete vertex;
-                return replacement;
-            }
-        } else if (value < vertex->value) {
-            if (vertex->left == nullptr) {
-                return nullptr;
-            } else {
-                vertex->left = Erase(vertex->left, value);
-            }
-            return vertex = Balance(vertex);
-        } else {
-            if (vertex->right == nullptr) {
-                return nullptr;
+    // Same as above, the smallest and largest nodes of the parts are found by the way
+    static std::tuple<Tree, NodeAvl<ValueType>*, Tree> Split(const Tree& tree,
+                                                             const ValueType& value)
+    {
+        NodeAvl<ValueType>* before = nullptr;
+        NodeAvl<ValueType>* after = nullptr;
+        for (auto vertex = tree.root; vertex != nullptr;) {
+            if (vertex->value < value) {
+                before = vertex;
+                vertex = vertex->right;
+            } else if (value < vertex->value) {
+                after = vertex;
+                vertex = vertex->left;
             } else {
-                vertex->right = Erase(vertex->right, value);
+                before = vertex == tree.first ? nullptr : vertex->prev;
+                after = vertex == tree.last ? nullptr : vertex->next;
+                break;
             }
-            return vertex = Balance(vertex);
         }
+        auto [less, equal, greater] = Split(tree.root, value);
+        return { { less, less ? tree.first : nullptr, before }, equal,
+                 { greater, after, greater ? tree.last : nullptr } };
     }
+
+    static Tree LeftSubtree(const Tree& tree)
+    {
+        auto root = tree.root;
+        return root->left ? Tree { root->left, tree.first, root->prev } : Tree {};
+    }
+
+    static Tree RightSubtree(const Tree& tree)
+    {
+        auto root = tree.root;
+        return root->right ? Tree { root->right, root->next, tree.last } : Tree {};
+    }
+
+    // Runs both tasks, the first one on the pool if there is enough work to share
+    template <typename FirstTask, typename SecondTask>
+    static auto Fork(ThreadPool* pool, size_t work, FirstTask first_task, SecondTask second_task)
+        -> std::pair<decltype(first_task()), decltype(second_task())>
+    {
+        if (pool == nullptr || work < kParallelGrain) {
+            auto first_result = first_task();
+            return { first_result, second_task() };
+        }
+        auto first_future = pool->Submit(first_task);
+        auto second_result = second_task();
+        return { pool->Wait(first_future), second_result };
+    }
+
+    // The set algebra below consumes both trees and reuses their nodes,
+    // O(m log(n / m + 1)) work and O(log n log m) span for trees of sizes m <= n
+    static Tree Union(const Tree& first, const Tree& second, ThreadPool* pool = nullptr)
+    {
+        if (first.root == nullptr) {
+            return second;
+        }
+        if (second.root == nullptr) {
+            return first;
+        }
+        const size_t work = first.root->size + second.root->size;
+        auto left = LeftSubtree(first);
+        auto right = RightSubtree(first);
+        Tree less, greater;
+        NodeAvl<ValueType>* equal;
+        std::tie(less, equal, greater) = Split(second, first.root->value);
+        delete equal;
+        auto [left_result, right_result] = Fork(
+            pool, work, [=] { return Union(left, less, pool); },
+            [=] { return Union(right, greater, pool); });
+        return Join(left_result, first.root, right_result);
+    }
+
+    static Tree Intersection(const Tree& first, const Tree& second, ThreadPool* pool = nullptr)
+    {
+        if (first.root == nullptr || second.root == nullptr) {
+            Clear(first.root);
+            Clear(second.root);
+            return {};
+        }
+        const size_t work = first.root->size + second.root->size;
+        auto left = LeftSubtree(first);
+        auto right = RightSubtree(first);
+        Tree less, greater;
+        NodeAvl<ValueType>* equal;
+        std::tie(less, equal, greater) = Split(second, first.root->value);
+        auto [left_result, right_result] = Fork(
+            pool, work, [=] { return Intersection(left, less, pool); },
+            [=] { return Intersection(right, greater, pool); });
+        if (equal == nullptr) {
+            delete first.root;
+            return Join2(left_result, right_result);
+        }
+        delete equal;
+        return Join(left_result, first.root, right_result);
+    }
+
+    // Values of first which are not in second
+    static Tree Difference(const Tree& first, NodeAvl<ValueType>* second,
+                           ThreadPool* pool = nullptr)
+    {
+        if (first.root == nullptr || second == nullptr) {
+            Clear(second);
+            return first;
+        }
+        const size_t work = first.root->size + second->size;
+        auto left = second->left;
+        auto right = second->right;
+        Tree less, greater;
+        NodeAvl<ValueType>* equal;
+        std::tie(less, equal, greater) = Split(first, second->value);
+        delete equal;
+        delete second;
+        auto [left_result, right_result] = Fork(
+            pool, work, [=] { return Difference(less, left, pool); },
+            [=] { return Difference(greater, right, pool); });
+        return Join2(left_result, right_result);
+    }
+
+    // Subproblems smaller than this are not worth a task
+    static constexpr size_t kParallelGrain = 1 << 13;
 };
 
 
@@ -371,18 +523,6 @@ public:
         NodeAvl<ValueType>* node;
         const Set<ValueType>* set;
 
-        NodeAvl<ValueType>* find_preend() const
-        {
-            auto vertex = set->root;
-            if (vertex == nullptr) {
-                return nullptr;
-            }
-            while (vertex->right != nullptr) {
-                vertex = vertex->right;
-            }
-            return vertex;
-        }
-
     public:
         using iterator_category = std::bidirectional_iterator_tag;
         using value_type = ValueType;
@@ -403,38 +543,13 @@ public:
 
         inline iterator& operator++()
         {
-            if (node->right != nullptr) {
-                node = node->right;
-                while (node->left != nullptr) {
-                    node = node->left;
-                }
-            } else {
-                while (node != nullptr && node->parent != nullptr && node == node->parent->right) {
-                    node = node->parent;
-                }
-                node = node->parent;
-            }
+            node = node->next;
             return *this;
         }
 
         inline iterator& operator--()
         {
-            if (node == nullptr) {
-                node = find_preend();
-                return *this;
-            }
-
-            if (node->left != nullptr) {
-                node = node->left;
-                while (node->right != nullptr) {
-                    node = node->right;
-                }
-            } else {
-                while (node != nullptr && node->parent != nullptr && node == node->parent->left) {
-                    node = node->parent;
-                }
-                node = node->parent;
-            }
+            node = node == nullptr ? set->last_ : node->prev;
             return *this;
         }
 
@@ -451,21 +566,17 @@ public:
             return old;
         }
 
-        const ValueType operator*() { return node->value; }
-        const ValueType* operator->() { return &node->value; }
+        reference operator*() const { return node->value; }
+        pointer operator->() const { return &node->value; }
 
         bool operator==(const iterator& other) const { return node == other.node; }
         bool operator!=(const iterator& other) const { return node != other.node; }
     };
 
-    Set()
-        : begin_(nullptr, nullptr)
-    {
-    }
+    Set() = default;
 
     template <typename InputIt>
     Set(InputIt first, InputIt last)
-        : begin_(nullptr, this)
     {
         while (first != last) {
             insert(*first++);
@@ -480,13 +591,17 @@ public:
     Set(const Set<ValueType>& other) // O(n log n)
         : Set(other.begin(), other.end())
     {
-    } 
+    }
+
+    Set(Set<ValueType>&& other) // O(1)
+    {
+        adopt(other.release());
+    }
 
     ~Set()
     {
         node_type::Clear(root);
         root = nullptr;
-        begin_ = { nullptr, nullptr };
     }
 
     // TODO
@@ -496,27 +611,38 @@ public:
             return *this;
 
         node_type::Clear(root);
-        root = nullptr;
-        begin_ = { nullptr, this };
-        size_ = 0;
+        adopt({});
 
         for (const auto& x : other) {
             insert(x);
         }
-        
+
         return *this;
     }
 
-    iterator begin() const { return begin_; }
+    Set<ValueType>& operator=(Set<ValueType>&& other) // O(1)
+    {
+        if (this == &other)
+            return *this;
+
+        node_type::Clear(root);
+        adopt(other.release());
+        return *this;
+    }
+
+    iterator begin() const { return { first_, this }; }
     iterator end() const { return { nullptr, this }; }
 
     void insert(const ValueType& value)
     {
         if (find(value) == end()) {
             root = node_type::Insert(root, value);
-            auto inserted = lower_bound(value);
-            if (size_ == 0 || *inserted < *begin_) {
-                begin_ = inserted;
+            if (size_ == 0) {
+                first_ = last_ = root;
+            } else if (value < first_->value) {
+                first_ = first_->prev;
+            } else if (last_->value < value) {
+                last_ = last_->next;
             }
             ++size_;
         }
@@ -533,13 +659,79 @@ public:
 
     void erase(const ValueType& value)
     {
-        if (find(value) != end()) {
+        auto node = node_type::Find(root, value);
+        if (node != nullptr) {
+            if (node == first_) {
+                first_ = node->next;
+            }
+            if (node == last_) {
+                last_ = node->prev;
+            }
             root = node_type::Erase(root, value);
-            begin_ = { find_begin(), this };
             --size_;
         }
     }
 
+    // O(log n) plus freeing the erased nodes
+    void erase(iterator first, iterator last)
+    {
+        if (first == last) {
+            return;
+        }
+        const ValueType first_value = *first;
+        auto [less, first_equal, rest] = node_type::Split(release(), first_value);
+        rest = node_type::Join(typename node_type::Tree {}, first_equal, rest);
+        if (last != end()) {
+            const ValueType last_value = *last;
+            auto [middle, last_equal, greater] = node_type::Split(rest, last_value);
+            node_type::Clear(middle.root);
+            rest = node_type::Join(typename node_type::Tree {}, last_equal, greater);
+        } else {
+            node_type::Clear(rest.root);
+            rest = {};
+        }
+        adopt(node_type::Join2(less, rest));
+    }
+
+    // Moves all values into the returned sets: values less than value and the rest, O(log n)
+    std::pair<Set<ValueType>, Set<ValueType>> split(const ValueType& value)
+    {
+        auto [less, equal, greater] = node_type::Split(release(), value);
+        if (equal != nullptr) {
+            greater = node_type::Join(typename node_type::Tree {}, equal, greater);
+        }
+        return { Set<ValueType>(less), Set<ValueType>(greater) };
+    }
+
+    // All values of left must be less than all values of right, O(log n)
+    static Set<ValueType> join(Set<ValueType>&& left, Set<ValueType>&& right)
+    {
+        assert(left.empty() || right.empty() || *std::prev(left.end()) < *right.begin());
+        return Set<ValueType>(node_type::Join2(left.release(), right.release()));
+    }
+
+    // The set algebra consumes both sets, O(m log(n / m + 1)) for sizes m <= n.
+    // With a pool the work is spread over its threads.
+    static Set<ValueType> set_union(Set<ValueType>&& first, Set<ValueType>&& second,
+                                    ThreadPool* pool = nullptr)
+    {
+        return Set<ValueType>(node_type::Union(first.release(), second.release(), pool));
+    }
+
+    static Set<ValueType> set_intersection(Set<ValueType>&& first, Set<ValueType>&& second,
+                                           ThreadPool* pool = nullptr)
+    {
+        return Set<ValueType>(
+            node_type::Intersection(first.release(), second.release(), pool));
+    }
+
+    static Set<ValueType> set_difference(Set<ValueType>&& first, Set<ValueType>&& second,
+                                         ThreadPool* pool = nullptr)
+    {
+        return Set<ValueType>(
+            node_type::Difference(first.release(), second.release().root, pool));
+    }
+
     iterator find(const ValueType& value) const
     {
         return { node_type::Find(root, value), this };
@@ -558,16 +750,33 @@ public:
 
 private:
     node_type* root = nullptr;
-    iterator begin_;
+    node_type* first_ = nullptr;
+    node_type* last_ = nullptr;
     size_t size_ = 0;
 
-    node_type* find_begin() const
+    explicit Set(const typename node_type::Tree& tree)
     {
-        auto vertex = root;
-        if (vertex == nullptr)
-            return vertex;
-        while (vertex->left != nullptr)
-            vertex = vertex->left;
-        return vertex;
+        adopt(tree);
+    }
+
+    typename node_type::Tree release()
+    {
+        typename node_type::Tree tree { root, first_, last_ };
+        adopt({});
+        return tree;
+    }
+
+    void adopt(const typename node_type::Tree& tree)
+    {
+        root = tree.root;
+        first_ = tree.first;
+        last_ = tree.last;
+        if (first_) {
+            first_->prev = nullptr;
+        }
+        if (last_) {
+            last_->next = nullptr;
+        }
+        size_ = node_type::GetSize(root);
     }
 };
@@ -0,0 +1,130 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of workers executing tasks in submission order. A thread waiting for a task
+// executes queued tasks meanwhile, so recursive fork-join algorithms never deadlock.
+class ThreadPool {
+public:
+    explicit ThreadPool(size_t threads_count = std::thread::hardware_concurrency())
+    {
+        threads_count = std::max<size_t>(threads_count, 1);
+        workers_.reserve(threads_count);
+        for (size_t i = 0; i < threads_count; ++i) {
+            workers_.emplace_back([this] { WorkerLoop(); });
+        }
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // Finishes all queued tasks
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopped_ = true;
+        }
+        has_tasks_.notify_all();
+        for (auto& worker : workers_) {
+            worker.join();
+        }
+    }
+
+    template <typename Function>
+    auto Submit(Function function) -> std::future<decltype(function())>
+    {
+        using Result = decltype(function());
+        auto task = std::make_shared<std::packaged_task<Result()>>(std::move(function));
+        auto future = task->get_future();
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            tasks_.emplace_back([task] { (*task)(); });
+        }
+        has_tasks_.notify_one();
+        return future;
+    }
+
+    // Runs one queued task on the calling thread, returns false if there was none
+    bool RunPendingTask()
+    {
+        std::function<void()> task;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (tasks_.empty()) {
+                return false;
+            }
+            task = std::move(tasks_.front());
+            tasks_.pop_front();
+        }
+        task();
+        return true;
+    }
+
+    // Works for std::future and std::shared_future
+    template <typename Future>
+    auto Wait(Future& future) -> decltype(future.get())
+    {
+        while (future.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+            if (!RunPendingTask()) {
+                std::this_thread::yield();
+            }
+        }
+        return future.get();
+    }
+
+    // Calls function(begin, end) for pieces of [0, count) on the workers and waits for all
+    template <typename Function>
+    void ParallelFor(size_t count, Function function)
+    {
+        auto pieces = std::min(count, Size() * kPiecesPerWorker);
+        std::vector<std::future<void>> futures;
+        futures.reserve(pieces);
+        for (size_t piece = 0; piece < pieces; ++piece) {
+            futures.push_back(Submit([&function, count, pieces, piece] {
+                function(count * piece / pieces, count * (piece + 1) / pieces);
+            }));
+        }
+        for (auto& future : futures) {
+            Wait(future);
+        }
+    }
+
+    size_t Size() const { return workers_.size(); }
+
+private:
+    // More pieces than workers, so uneven pieces still keep every worker busy
+    static const size_t kPiecesPerWorker = 8;
+
+    std::vector<std::thread> workers_;
+    std::deque<std::function<void()>> tasks_;
+    std::mutex mutex_;
+    std::condition_variable has_tasks_;
+    bool stopped_ = false;
+
+    void WorkerLoop()
+    {
+        while (true) {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                has_tasks_.wait(lock, [this] { return stopped_ || !tasks_.empty(); });
+                if (tasks_.empty()) {
+                    return;
+                }
+                task = std::move(tasks_.front());
+                tasks_.pop_front();
+            }
+            task();
+        }
+    }
+};
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <chrono>
+#include <cstdlib>
+#include <vector>
+
+// Seconds since construction
+class Timer {
+public:
+    double Seconds() const
+    {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start_).count();
+    }
+
+private:
+    std::chrono::steady_clock::time_point start_ = std::chrono::steady_clock::now();
+};
+
+// Sizes given as the arguments of main, or defaults if there are none
+inline std::vector<size_t> SizesFromArguments(int argc, char** argv, std::vector<size_t> defaults)
+{
+    if (argc <= 1) {
+        return defaults;
+    }
+    std::vector<size_t> sizes;
+    for (int i = 1; i < argc; ++i) {
+        sizes.push_back(std::strtoull(argv[i], nullptr, 10));
+    }
+    return sizes;
+}
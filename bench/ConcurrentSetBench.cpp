@@ -0,0 +1,122 @@
+// ConcurrentSet against Set behind a mutex and behind a shared mutex, on 1 to 64 threads
+// and on read-heavy and write-heavy mixes. Build from the repository root:
+//     g++ -O2 -std=c++17 -I. bench/ConcurrentSetBench.cpp -o concurrent_set_bench -pthread
+
+#include <cstdio>
+#include <mutex>
+#include <random>
+#include <shared_mutex>
+#include <thread>
+#include <vector>
+
+#include "Bench.h"
+#include "ConcurrentSet.h"
+#include "Set.h"
+
+namespace {
+
+const int kKeys = 1 << 20;
+const int kOperationsPerThread = 200000;
+
+class LockedSet {
+public:
+    bool contains(int value)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return set_.find(value) != set_.end();
+    }
+
+    void insert(int value)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        set_.insert(value);
+    }
+
+    void erase(int value)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        set_.erase(value);
+    }
+
+private:
+    std::mutex mutex_;
+    Set<int> set_;
+};
+
+class SharedLockedSet {
+public:
+    bool contains(int value)
+    {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        return set_.find(value) != set_.end();
+    }
+
+    void insert(int value)
+    {
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+        set_.insert(value);
+    }
+
+    void erase(int value)
+    {
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+        set_.erase(value);
+    }
+
+private:
+    std::shared_mutex mutex_;
+    Set<int> set_;
+};
+
+// Millions of operations per second; updates are half inserts and half erases
+template <typename SetType>
+double Run(int threads_count, int update_percent)
+{
+    SetType set;
+    std::mt19937 generator(1);
+    for (int i = 0; i < kKeys / 2; ++i) {
+        set.insert(generator() % kKeys);
+    }
+    std::vector<std::thread> threads;
+    Timer timer;
+    for (int thread = 0; thread < threads_count; ++thread) {
+        threads.emplace_back([&set, thread, update_percent] {
+            std::mt19937 generator(thread + 2);
+            size_t found = 0;
+            for (int i = 0; i < kOperationsPerThread; ++i) {
+                int value = generator() % kKeys;
+                int operation = generator() % 100;
+                if (operation >= update_percent) {
+                    found += set.contains(value);
+                } else if (operation % 2 == 0) {
+                    set.insert(value);
+                } else {
+                    set.erase(value);
+                }
+            }
+            volatile size_t sink = found;
+            (void)sink;
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    return threads_count * static_cast<double>(kOperationsPerThread) / timer.Seconds() / 1e6;
+}
+
+}  // namespace
+
+int main()
+{
+    for (int update_percent : { 10, 50 }) {
+        std::printf("%d%% updates, Mops/s\n", update_percent);
+        std::printf("%8s %14s %14s %14s\n", "threads", "ConcurrentSet", "mutex Set",
+                    "shared_mutex Set");
+        for (int threads = 1; threads <= 64; threads *= 2) {
+            std::printf("%8d %14.2f %14.2f %14.2f\n", threads,
+                        Run<ConcurrentSet<int>>(threads, update_percent),
+                        Run<LockedSet>(threads, update_percent),
+                        Run<SharedLockedSet>(threads, update_percent));
+        }
+    }
+}
@@ -0,0 +1,70 @@
+// FixedSet lookups with the linear (a * x + b) mod p mod m hash family, which divides
+// on every lookup, against the default multiply-shift family on power of two tables.
+// Sizes are given as arguments, 10^5, 10^6 and 10^7 by default. Build from the
+// repository root:
+//     g++ -O2 -std=c++17 -I. bench/FixedSetBench.cpp -o fixed_set_bench -pthread
+
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#include "Bench.h"
+#include "FixedSet.h"
+
+namespace {
+
+// Seconds of the build, of Contains on present keys, on random keys which are mostly
+// absent, and of ContainsBatch on the present keys
+template <typename HashFamily>
+void Run(const char* name, const std::vector<uint64_t>& keys, const std::vector<uint64_t>& queries)
+{
+    FixedSet<uint64_t, std::hash<uint64_t>, HashFamily> set;
+    Timer build_timer;
+    set.Initialize(keys);
+    auto build_seconds = build_timer.Seconds();
+
+    size_t found = 0;
+    Timer hit_timer;
+    for (auto key : keys) {
+        found += set.Contains(key);
+    }
+    auto hit_seconds = hit_timer.Seconds();
+
+    Timer miss_timer;
+    for (auto query : queries) {
+        found += set.Contains(query);
+    }
+    auto miss_seconds = miss_timer.Seconds();
+
+    std::vector<uint8_t> result(keys.size());
+    Timer batch_timer;
+    set.ContainsBatch(keys.data(), keys.size(), result.data());
+    auto batch_seconds = batch_timer.Seconds();
+    for (auto contained : result) {
+        found += contained;
+    }
+
+    std::printf("%14s %9.3f %9.3f %9.3f %9.3f   (found %zu)\n", name, build_seconds, hit_seconds,
+                miss_seconds, batch_seconds, found);
+}
+
+}  // namespace
+
+int main(int argc, char** argv)
+{
+    for (auto size : SizesFromArguments(argc, argv, { 100000, 1000000, 10000000 })) {
+        std::mt19937_64 generator(1);
+        std::vector<uint64_t> keys(size), queries(size);
+        for (auto& key : keys) {
+            key = generator();
+        }
+        for (auto& query : queries) {
+            query = generator();
+        }
+        std::printf("n = %zu, seconds\n%14s %9s %9s %9s %9s\n", size, "", "build", "hit", "miss",
+                    "batch");
+        Run<LinearHashFamily>("linear", keys, queries);
+        Run<MultiplyShiftHashFamily>("multiply-shift", keys, queries);
+    }
+}
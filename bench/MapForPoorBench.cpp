@@ -0,0 +1,121 @@
+// MapForPoor inserts and lookups of random keys. Sizes are given as arguments, 10^7 by
+// default. Keys with a Hash get Bloom filters, which skip most runs. Plain keys get
+// none, and in amortized mode their levels are searched through fractional cascading,
+// while incremental mode binary searches every run. Then one sorted run of every level
+// size is searched by std::lower_bound and by the branch-free search of the runs. Build
+// from the repository root:
+//     g++ -O2 -std=c++17 -I. bench/MapForPoorBench.cpp -o map_for_poor_bench
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#include "Bench.h"
+#include "MapForPoor.h"
+
+namespace {
+
+// Has no std::hash, so its maps keep no filters
+struct Plain {
+    uint64_t value;
+
+    bool operator<(const Plain& other) const { return value < other.value; }
+    bool operator==(const Plain& other) const { return value == other.value; }
+};
+
+// Seconds of the inserts, each of which also looks the key up to keep the size, of
+// lookups of present keys and of random keys, which are almost all absent
+template <typename Key>
+void Run(const char* name, bool incremental, const std::vector<uint64_t>& keys,
+         const std::vector<uint64_t>& queries)
+{
+    MapForPoor<Key, uint64_t> map(incremental);
+    Timer insert_timer;
+    for (auto key : keys) {
+        map.insert({ Key{ key }, key });
+    }
+    auto insert_seconds = insert_timer.Seconds();
+
+    size_t found = 0;
+    Timer hit_timer;
+    for (auto key : keys) {
+        found += map.contains(Key{ key });
+    }
+    auto hit_seconds = hit_timer.Seconds();
+
+    Timer miss_timer;
+    for (auto query : queries) {
+        found += map.contains(Key{ query });
+    }
+    auto miss_seconds = miss_timer.Seconds();
+
+    std::printf("%28s %9.3f %9.3f %9.3f   (found %zu)\n", name, insert_seconds, hit_seconds,
+                miss_seconds, found);
+}
+
+// Exposes the search MapForPoor uses inside its runs
+struct RunSearch : SortedRuns<uint64_t, uint64_t, std::hash<uint64_t>> {
+    using SortedRuns::branchless_lower_bound;
+};
+
+// Nanoseconds per search of random keys in a sorted run of size keys
+void RunLevel(size_t size, std::mt19937_64& generator)
+{
+    const size_t kQueries = 1 << 20;
+    std::vector<uint64_t> run(size), queries(kQueries);
+    for (auto& key : run) {
+        key = generator();
+    }
+    std::sort(run.begin(), run.end());
+    for (auto& query : queries) {
+        query = generator();
+    }
+
+    size_t checksum = 0;
+    Timer std_timer;
+    for (auto query : queries) {
+        checksum += std::lower_bound(run.begin(), run.end(), query) - run.begin();
+    }
+    auto std_nanoseconds = std_timer.Seconds() * 1e9 / kQueries;
+
+    auto less = [](uint64_t key) {
+        return [key](uint64_t element) { return element < key; };
+    };
+    Timer branchless_timer;
+    for (auto query : queries) {
+        checksum -= RunSearch::branchless_lower_bound(run.data(), run.data() + size, less(query))
+                    - run.data();
+    }
+    auto branchless_nanoseconds = branchless_timer.Seconds() * 1e9 / kQueries;
+
+    std::printf("%9zu %12.1f %12.1f   (checksum %zu)\n", size, std_nanoseconds,
+                branchless_nanoseconds, checksum);
+}
+
+}  // namespace
+
+int main(int argc, char** argv)
+{
+    std::mt19937_64 generator(1);
+    for (auto size : SizesFromArguments(argc, argv, { 10000000 })) {
+        std::vector<uint64_t> keys(size), queries(size);
+        for (auto& key : keys) {
+            key = generator();
+        }
+        for (auto& query : queries) {
+            query = generator();
+        }
+        std::printf("n = %zu, seconds\n%28s %9s %9s %9s\n", size, "", "insert", "hit", "miss");
+        Run<Plain>("amortized, cascades", false, keys, queries);
+        Run<Plain>("incremental, no cascades", true, keys, queries);
+        Run<uint64_t>("amortized, filters", false, keys, queries);
+        Run<uint64_t>("incremental, filters", true, keys, queries);
+    }
+
+    std::printf("\nnanoseconds per search\n%9s %12s %12s\n", "level", "std", "branchless");
+    for (size_t size = 1 << 10; size <= (1 << 23); size *= 2) {
+        RunLevel(size, generator);
+    }
+}
@@ -0,0 +1,90 @@
+// BTreeSet against the AVL Set and std::set on random int keys. Sizes are given as
+// arguments, 10^5, 10^6 and 10^7 by default. Build from the repository root:
+//     g++ -O2 -std=c++17 -I. bench/SetBench.cpp -o set_bench
+
+#include <cstdio>
+#include <random>
+#include <set>
+#include <vector>
+
+#include "BTreeSet.h"
+#include "Bench.h"
+#include "Set.h"
+
+namespace {
+
+// Seconds of inserts, finds of present keys, lower bounds of random keys, a full scan,
+// erases of half the keys by value and of the other half by the iterator find returns
+template <typename SetType>
+void Run(const char* name, const std::vector<int>& keys, const std::vector<int>& queries)
+{
+    SetType set;
+    Timer insert_timer;
+    for (auto key : keys) {
+        set.insert(key);
+    }
+    auto insert_seconds = insert_timer.Seconds();
+
+    size_t checksum = 0;
+    Timer find_timer;
+    for (auto key : keys) {
+        checksum += set.find(key) != set.end();
+    }
+    auto find_seconds = find_timer.Seconds();
+
+    Timer lower_bound_timer;
+    for (auto query : queries) {
+        auto iterator = set.lower_bound(query);
+        checksum += iterator != set.end() ? *iterator : 0;
+    }
+    auto lower_bound_seconds = lower_bound_timer.Seconds();
+
+    Timer scan_timer;
+    for (auto value : set) {
+        checksum += value;
+    }
+    auto scan_seconds = scan_timer.Seconds();
+
+    auto middle = keys.begin() + keys.size() / 2;
+    Timer erase_timer;
+    for (auto key = keys.begin(); key != middle; ++key) {
+        set.erase(*key);
+    }
+    auto erase_seconds = erase_timer.Seconds();
+
+    Timer erase_iterator_timer;
+    for (auto key = middle; key != keys.end(); ++key) {
+        // Keys may repeat, and std::set does not take end()
+        auto found = set.find(*key);
+        if (found != set.end()) {
+            set.erase(found);
+        }
+    }
+    auto erase_iterator_seconds = erase_iterator_timer.Seconds();
+    checksum += set.size();
+
+    std::printf("%10s %9.3f %9.3f %12.3f %9.3f %9.3f %9.3f   (checksum %zu)\n", name,
+                insert_seconds, find_seconds, lower_bound_seconds, scan_seconds, erase_seconds,
+                erase_iterator_seconds, checksum);
+}
+
+}  // namespace
+
+int main(int argc, char** argv)
+{
+    for (auto size : SizesFromArguments(argc, argv, { 100000, 1000000, 10000000 })) {
+        std::mt19937 generator(1);
+        std::vector<int> keys(size), queries(size);
+        for (auto& key : keys) {
+            key = generator();
+        }
+        for (auto& query : queries) {
+            query = generator();
+        }
+        std::printf("n = %zu, seconds\n%10s %9s %9s %12s %9s %9s %9s\n", size, "", "insert",
+                    "find", "lower_bound", "scan", "erase", "erase_it");
+        Run<BTreeSet<int>>("BTreeSet", keys, queries);
+        Run<Set<int>>("Set", keys, queries);
+        Run<std::set<int>>("std::set", keys, queries);
+    }
+}